@@ -0,0 +1,400 @@
+//
+//  corpus_generator.cpp
+//  photo-exif-parsing
+//
+
+#include "corpus_generator.h"
+#include "work_stealing_pool.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
+
+namespace {
+    enum TiffType { TIFF_BYTE = 1, TIFF_ASCII = 2, TIFF_SHORT = 3, TIFF_LONG = 4, TIFF_RATIONAL = 5, TIFF_UNDEFINED = 7 };
+
+    // Room for the APP1 payload after its length field.
+    const size_t kMaxApp1Payload = 65533;
+
+    // TIFF in either byte order, laid out as header, then each IFD followed
+    // by the values that don't fit in its entries.
+    class TiffBuilder
+    {
+    public:
+        struct Entry
+        {
+            uint16_t tag;
+            uint16_t type;
+            uint32_t count;
+            std::vector<unsigned char> value;
+        };
+        typedef std::vector<Entry> Ifd;
+
+        explicit TiffBuilder(bool bigEndian) : bigEndian(bigEndian) {}
+
+        void ascii(Ifd &ifd, uint16_t tag, const std::string &text) const {
+            Entry entry = { tag, TIFF_ASCII, (uint32_t)text.size() + 1,
+                            std::vector<unsigned char>(text.begin(), text.end()) };
+            entry.value.push_back(0);
+            ifd.push_back(entry);
+        }
+
+        void number(Ifd &ifd, uint16_t tag, uint16_t type, uint32_t value) const {
+            Entry entry = { tag, type, 1, std::vector<unsigned char>() };
+            if (type == TIFF_SHORT) put16(entry.value, (uint16_t)value);
+            else if (type == TIFF_BYTE) entry.value.push_back((unsigned char)value);
+            else put32(entry.value, value);
+            ifd.push_back(entry);
+        }
+
+        void rationals(Ifd &ifd, uint16_t tag, const double *values, uint32_t count, uint32_t denominator) const {
+            Entry entry = { tag, TIFF_RATIONAL, count, std::vector<unsigned char>() };
+            for (uint32_t i = 0; i < count; i++) {
+                put32(entry.value, (uint32_t)llround(values[i] * denominator));
+                put32(entry.value, denominator);
+            }
+            ifd.push_back(entry);
+        }
+
+        void undefined(Ifd &ifd, uint16_t tag, const std::vector<unsigned char> &bytes) const {
+            Entry entry = { tag, TIFF_UNDEFINED, (uint32_t)bytes.size(), bytes };
+            ifd.push_back(entry);
+        }
+
+        // Points the LONG entry tag at offset.
+        void setOffset(Ifd &ifd, uint16_t tag, size_t offset) const {
+            for (size_t i = 0; i < ifd.size(); i++) {
+                if (ifd[i].tag != tag) continue;
+                ifd[i].value.clear();
+                put32(ifd[i].value, (uint32_t)offset);
+            }
+        }
+
+        static size_t size(const Ifd &ifd) {
+            size_t bytes = 2 + 12 * ifd.size() + 4;
+            for (size_t i = 0; i < ifd.size(); i++) {
+                if (ifd[i].value.size() > 4) bytes += ifd[i].value.size() + (ifd[i].value.size() & 1);
+            }
+            return bytes;
+        }
+
+        void header(std::vector<unsigned char> &out) const {
+            out.push_back(bigEndian ? 'M' : 'I');
+            out.push_back(bigEndian ? 'M' : 'I');
+            put16(out, 42);
+            put32(out, 8);
+        }
+
+        // Appends ifd, which must start at offset out.size() - base, linked
+        // to the IFD at next (0 for none).
+        void write(const Ifd &ifd, size_t base, size_t next, std::vector<unsigned char> &out) const {
+            size_t valueOffset = out.size() - base + 2 + 12 * ifd.size() + 4;
+            std::vector<unsigned char> values;
+            put16(out, (uint16_t)ifd.size());
+            for (size_t i = 0; i < ifd.size(); i++) {
+                const Entry &entry = ifd[i];
+                put16(out, entry.tag);
+                put16(out, entry.type);
+                put32(out, entry.count);
+                if (entry.value.size() <= 4)
+                {
+                    out.insert(out.end(), entry.value.begin(), entry.value.end());
+                    out.insert(out.end(), 4 - entry.value.size(), 0);
+                }
+                else
+                {
+                    put32(out, (uint32_t)(valueOffset + values.size()));
+                    values.insert(values.end(), entry.value.begin(), entry.value.end());
+                    if (values.size() & 1) values.push_back(0);
+                }
+            }
+            put32(out, (uint32_t)next);
+            out.insert(out.end(), values.begin(), values.end());
+        }
+
+        void put16(std::vector<unsigned char> &out, uint16_t value) const {
+            out.push_back((unsigned char)(bigEndian ? value >> 8 : value));
+            out.push_back((unsigned char)(bigEndian ? value : value >> 8));
+        }
+
+        void put32(std::vector<unsigned char> &out, uint32_t value) const {
+            put16(out, (uint16_t)(bigEndian ? value >> 16 : value));
+            put16(out, (uint16_t)(bigEndian ? value : value >> 16));
+        }
+
+    private:
+        bool bigEndian;
+    };
+
+    void appendSegment(std::vector<unsigned char> &out, unsigned char marker,
+                       const unsigned char *payload, size_t length) {
+        out.push_back(0xFF);
+        out.push_back(marker);
+        out.push_back((unsigned char)((length + 2) >> 8));
+        out.push_back((unsigned char)(length + 2));
+        out.insert(out.end(), payload, payload + length);
+    }
+
+    // Bytes that never contain 0xFF, so they can't be mistaken for markers.
+    void appendFiller(std::vector<unsigned char> &out, size_t length, uint32_t state) {
+        state |= 1;
+        for (size_t i = 0; i < length; i++) {
+            state = state * 1664525 + 1013904223;
+            out.push_back((unsigned char)((state >> 24) % 0xFF));
+        }
+    }
+
+    // A tiny JPEG of exactly length bytes (at least 4) to stand in for a
+    // thumbnail.
+    void buildThumbnail(size_t length, std::vector<unsigned char> &out) {
+        out.clear();
+        out.push_back(0xFF);
+        out.push_back(0xD8);
+        appendFiller(out, length - 4, (uint32_t)length);
+        out.push_back(0xFF);
+        out.push_back(0xD9);
+    }
+
+    void degreesMinutesSeconds(double value, double *parts) {
+        value = fabs(value);
+        parts[0] = floor(value);
+        parts[1] = floor((value - parts[0]) * 60);
+        parts[2] = (value - parts[0] - parts[1] / 60) * 3600;
+    }
+
+    int makeDirectory(const std::string &path) {
+        if (mkdir(path.c_str(), 0755) == 0 || errno == EEXIST) return 0;
+        return -1;
+    }
+
+    // Leaf directory of file index, relative to the root, without the
+    // trailing slash.
+    std::string leafDirectory(const CorpusOptions &options, size_t index) {
+        size_t leaf = index / std::max<size_t>(1, options.filesPerDirectory);
+        std::string path;
+        for (unsigned level = options.depth; level-- > 0; ) {
+            size_t span = 1;
+            for (unsigned i = 0; i < level; i++) span *= std::max<size_t>(1, options.fanout);
+            size_t component = leaf / span;
+            if (level + 1 < options.depth) component %= std::max<size_t>(1, options.fanout);
+
+            char name[32];
+            snprintf(name, sizeof(name), "/d%03zu", component);
+            path += name;
+        }
+        return path;
+    }
+
+    // Everything about file index that depends on the seed.
+    SyntheticPhoto photoFor(const CorpusOptions &options, size_t index) {
+        std::mt19937_64 random(options.seed ^ (index * 0x9E3779B97F4A7C15ULL));
+        std::uniform_int_distribution<int64_t> times(1262304000LL * 1000, 1609459200LL * 1000);
+        std::uniform_real_distribution<double> unit(0, 1);
+
+        SyntheticPhoto photo;
+        photo.timeTaken = times(random) * 1000000;
+        photo.hasGPS = unit(random) < options.gpsFraction;
+        photo.latitude = -60 + 130 * unit(random);
+        photo.longitude = -180 + 360 * unit(random);
+        photo.altitude = 12.5;
+        photo.width = 3264;
+        photo.height = 2448;
+        photo.bigEndian = options.byteOrder == CORPUS_BIG_ENDIAN ||
+                          (options.byteOrder == CORPUS_MIXED_ENDIAN && (index & 1));
+        photo.app1Offset = options.app1Offset;
+        photo.makerNoteSize = options.makerNoteSize;
+        photo.thumbnailSize = options.thumbnailSize;
+        photo.fileSize = options.fileSize;
+        return photo;
+    }
+}
+
+void buildSyntheticJpeg(const SyntheticPhoto &photo, std::vector<unsigned char> &out) {
+    TiffBuilder tiff(photo.bigEndian);
+    typedef TiffBuilder::Ifd Ifd;
+
+    time_t seconds = (time_t)(photo.timeTaken / 1000000000LL);
+    struct tm fields;
+    gmtime_r(&seconds, &fields);
+    char dateTime[32];
+    strftime(dateTime, sizeof(dateTime), "%Y:%m:%d %H:%M:%S", &fields);
+    char subSec[8];
+    snprintf(subSec, sizeof(subSec), "%03d", (int)(photo.timeTaken % 1000000000LL / 1000000));
+
+    Ifd ifd0, exif, gps, ifd1;
+    tiff.ascii(ifd0, 0x010F, "Apple");
+    tiff.ascii(ifd0, 0x0110, "iPhone 6");
+    tiff.number(ifd0, 0x0112, TIFF_SHORT, 1);
+    tiff.ascii(ifd0, 0x0131, "8.3");
+    tiff.number(ifd0, 0x8769, TIFF_LONG, 0);
+    if (photo.hasGPS) tiff.number(ifd0, 0x8825, TIFF_LONG, 0);
+
+    double exposure = 1.0 / 120, fNumber = 2.2;
+    tiff.rationals(exif, 0x829A, &exposure, 1, 1200);
+    tiff.rationals(exif, 0x829D, &fNumber, 1, 10);
+    tiff.number(exif, 0x8827, TIFF_SHORT, 32);
+    tiff.ascii(exif, 0x9003, dateTime);
+    tiff.ascii(exif, 0x9291, subSec);
+
+    if (photo.hasGPS)
+    {
+        double latitude[3], longitude[3], altitude = fabs(photo.altitude);
+        degreesMinutesSeconds(photo.latitude, latitude);
+        degreesMinutesSeconds(photo.longitude, longitude);
+        tiff.ascii(gps, 1, photo.latitude < 0 ? "S" : "N");
+        tiff.rationals(gps, 2, latitude, 3, 1000);
+        tiff.ascii(gps, 3, photo.longitude < 0 ? "W" : "E");
+        tiff.rationals(gps, 4, longitude, 3, 1000);
+        tiff.number(gps, 5, TIFF_BYTE, photo.altitude < 0 ? 1 : 0);
+        tiff.rationals(gps, 6, &altitude, 1, 100);
+    }
+
+    size_t thumbnailSize = photo.thumbnailSize;
+    if (thumbnailSize)
+    {
+        tiff.number(ifd1, 0x0103, TIFF_SHORT, 6);
+        tiff.number(ifd1, 0x0201, TIFF_LONG, 0);
+        tiff.number(ifd1, 0x0202, TIFF_LONG, 0);
+    }
+
+    // Whatever is left of the segment after the fixed parts bounds the
+    // MakerNote, then the thumbnail.
+    // (Three more Exif entries and a pad byte are still to come.)
+    size_t fixed = 6 + 8 + TiffBuilder::size(ifd0) + TiffBuilder::size(exif) + 3 * 12 + 1 +
+                   TiffBuilder::size(gps) + (thumbnailSize ? TiffBuilder::size(ifd1) : 0);
+    size_t room = kMaxApp1Payload > fixed ? kMaxApp1Payload - fixed : 0;
+    size_t makerNoteSize = std::min(photo.makerNoteSize, room);
+    room -= makerNoteSize;
+    thumbnailSize = std::min(thumbnailSize, room);
+    if (thumbnailSize < 4) thumbnailSize = 0;
+
+    if (makerNoteSize)
+    {
+        std::vector<unsigned char> makerNote;
+        const char tag[] = "Apple iOS\0";
+        makerNote.insert(makerNote.end(), tag, tag + std::min(sizeof(tag), makerNoteSize));
+        appendFiller(makerNote, makerNoteSize - makerNote.size(), (uint32_t)makerNoteSize);
+        tiff.undefined(exif, 0x927C, makerNote);
+    }
+    tiff.number(exif, 0xA002, TIFF_LONG, photo.width);
+    tiff.number(exif, 0xA003, TIFF_LONG, photo.height);
+
+    // Sizes don't depend on the offsets, so lay out the IFDs first.
+    size_t exifOffset = 8 + TiffBuilder::size(ifd0);
+    size_t gpsOffset = exifOffset + TiffBuilder::size(exif);
+    size_t ifd1Offset = gpsOffset + (photo.hasGPS ? TiffBuilder::size(gps) : 0);
+    size_t thumbnailOffset = ifd1Offset + TiffBuilder::size(ifd1);
+    tiff.setOffset(ifd0, 0x8769, exifOffset);
+    tiff.setOffset(ifd0, 0x8825, gpsOffset);
+    tiff.setOffset(ifd1, 0x0201, thumbnailOffset);
+    tiff.setOffset(ifd1, 0x0202, thumbnailSize);
+
+    std::vector<unsigned char> app1;
+    const char exifHeader[] = "Exif\0\0";
+    app1.insert(app1.end(), exifHeader, exifHeader + 6);
+    tiff.header(app1);
+    tiff.write(ifd0, 6, thumbnailSize ? ifd1Offset : 0, app1);
+    tiff.write(exif, 6, 0, app1);
+    if (photo.hasGPS) tiff.write(gps, 6, 0, app1);
+    if (thumbnailSize)
+    {
+        std::vector<unsigned char> thumbnail;
+        buildThumbnail(thumbnailSize, thumbnail);
+        tiff.write(ifd1, 6, 0, app1);
+        app1.insert(app1.end(), thumbnail.begin(), thumbnail.end());
+    }
+
+    out.clear();
+    out.push_back(0xFF);
+    out.push_back(0xD8);
+    const unsigned char jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 72, 0, 72, 0, 0 };
+    appendSegment(out, 0xE0, jfif, sizeof(jfif));
+
+    // APP2 segments (as an ICC profile would be) push APP1 out to
+    // app1Offset, never leaving a gap too small for a segment header.
+    std::vector<unsigned char> padding;
+    while (photo.app1Offset >= out.size() + 4) {
+        size_t gap = photo.app1Offset - out.size();
+        size_t length = std::min(gap, kMaxApp1Payload + 4);
+        if (gap - length > 0 && gap - length < 4) length -= 4;
+        padding.clear();
+        appendFiller(padding, length - 4, (uint32_t)out.size());
+        appendSegment(out, 0xE2, padding.data(), padding.size());
+    }
+    appendSegment(out, 0xE1, &app1[0], app1.size());
+
+    unsigned char quantization[65] = { 0 };
+    for (size_t i = 1; i < sizeof(quantization); i++) quantization[i] = 1;
+    appendSegment(out, 0xDB, quantization, sizeof(quantization));
+    const unsigned char frame[] = { 8, (unsigned char)(photo.height >> 8), (unsigned char)photo.height,
+                                    (unsigned char)(photo.width >> 8), (unsigned char)photo.width,
+                                    1, 1, 0x11, 0 };
+    appendSegment(out, 0xC0, frame, sizeof(frame));
+    const unsigned char scan[] = { 1, 1, 0, 0, 63, 0 };
+    appendSegment(out, 0xDA, scan, sizeof(scan));
+
+    size_t fill = photo.fileSize > out.size() + 2 ? photo.fileSize - out.size() - 2 : 0;
+    appendFiller(out, fill, (uint32_t)photo.timeTaken);
+    out.push_back(0xFF);
+    out.push_back(0xD9);
+}
+
+CorpusOptions::CorpusOptions()
+: count(1000), seed(42), gpsFraction(0.8), byteOrder(CORPUS_LITTLE_ENDIAN),
+  app1Offset(0), makerNoteSize(0), thumbnailSize(0), fileSize(256 * 1024),
+  filesPerDirectory(1000), depth(1), fanout(100)
+{
+}
+
+std::string corpusFilePath(const std::string &root, const CorpusOptions &options, size_t index) {
+    char name[32];
+    snprintf(name, sizeof(name), "/IMG_%07zu.jpg", index);
+    return root + leafDirectory(options, index) + name;
+}
+
+int generateCorpus(const std::string &root, const CorpusOptions &options,
+                   WorkStealingPool *pool, uint64_t *bytesWritten) {
+    if (makeDirectory(root)) return -1;
+
+    // Directories up front, in order, so parents always exist.
+    size_t perDirectory = std::max<size_t>(1, options.filesPerDirectory);
+    for (size_t first = 0; first < options.count; first += perDirectory) {
+        std::string leaf = leafDirectory(options, first);
+        for (size_t slash = 1; slash != std::string::npos; ) {
+            slash = leaf.find('/', slash + 1);
+            if (makeDirectory(root + leaf.substr(0, slash))) return -1;
+        }
+    }
+
+    std::atomic<uint64_t> total(0);
+    std::atomic<bool> failed(false);
+    const size_t kFilesPerTask = 256;
+    auto writeRange = [&](size_t first) {
+        std::vector<unsigned char> bytes;
+        size_t last = std::min(options.count, first + kFilesPerTask);
+        for (size_t i = first; i < last && !failed; i++) {
+            buildSyntheticJpeg(photoFor(options, i), bytes);
+            FILE *fp = fopen(corpusFilePath(root, options, i).c_str(), "wb");
+            bool ok = fp && fwrite(&bytes[0], 1, bytes.size(), fp) == bytes.size();
+            if (fp && fclose(fp) != 0) ok = false;
+            if (!ok) failed = true;
+            total += bytes.size();
+        }
+    };
+
+    for (size_t first = 0; first < options.count; first += kFilesPerTask) {
+        if (pool) pool->submit([&writeRange, first] { writeRange(first); });
+        else writeRange(first);
+    }
+    if (pool) pool->wait();
+
+    if (failed) return -1;
+    if (bytesWritten) *bytesWritten = total;
+    return 0;
+}
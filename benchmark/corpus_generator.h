@@ -0,0 +1,84 @@
+//
+//  corpus_generator.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__corpus_generator__
+#define __photo_exif_parsing__corpus_generator__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class WorkStealingPool;
+
+// What goes into one synthetic photo, contents and layout.
+struct SyntheticPhoto
+{
+    int64_t timeTaken;      // nanoseconds since the epoch, written as UTC
+    bool hasGPS;
+    double latitude;
+    double longitude;
+    double altitude;
+    unsigned width;
+    unsigned height;
+
+    bool bigEndian;         // "MM" TIFF header instead of "II"
+    size_t app1Offset;      // where APP1 starts; APP2 padding fills the gap
+    size_t makerNoteSize;   // bytes of MakerNote in the Exif IFD, 0 for none
+    size_t thumbnailSize;   // bytes of IFD1 JPEG thumbnail, 0 for none
+    size_t fileSize;        // total bytes; the scan data is padded to fit
+};
+
+// Encodes a minimal but valid JPEG: SOI, JFIF APP0, optional APP2 padding,
+// an Exif APP1 (IFD0 with make, model, orientation and software; the Exif
+// sub-IFD with DateTimeOriginal, SubSecTimeOriginal, ISO, exposure, size
+// and MakerNote; the GPS IFD; IFD1 with the thumbnail), then a quantization
+// table, SOF0, SOS, filler scan data and EOI.
+//
+// APP1 has to fit one segment, so the MakerNote and then the thumbnail are
+// cut down to keep it under 64 KB.
+void buildSyntheticJpeg(const SyntheticPhoto &photo, std::vector<unsigned char> &out);
+
+enum CorpusByteOrder
+{
+    CORPUS_LITTLE_ENDIAN,
+    CORPUS_BIG_ENDIAN,
+    CORPUS_MIXED_ENDIAN     // alternates file by file
+};
+
+struct CorpusOptions
+{
+    CorpusOptions();
+
+    size_t count;
+    uint64_t seed;
+
+    double gpsFraction;     // share of photos with a GPS IFD, 0 to 1
+    CorpusByteOrder byteOrder;
+    size_t app1Offset;
+    size_t makerNoteSize;
+    size_t thumbnailSize;
+    size_t fileSize;
+
+    // Files go filesPerDirectory to a leaf directory, with leaves nested
+    // depth levels deep and fanout directories per level below the top.
+    size_t filesPerDirectory;
+    unsigned depth;
+    size_t fanout;
+};
+
+// Path of file index below root for the given layout.
+std::string corpusFilePath(const std::string &root, const CorpusOptions &options, size_t index);
+
+// Writes options.count photos under root. Times (2010-2020), coordinates and
+// byte order come from options.seed and each file's index alone, so the
+// corpus is the same whatever the pool size. With a pool the files are
+// written by its workers; the pool must be otherwise idle. Returns 0 or -1
+// if a directory or file can't be written; on success bytesWritten holds
+// the corpus size.
+int generateCorpus(const std::string &root, const CorpusOptions &options,
+                   WorkStealingPool *pool, uint64_t *bytesWritten);
+
+#endif /* defined(__photo_exif_parsing__corpus_generator__) */
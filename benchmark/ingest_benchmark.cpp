@@ -0,0 +1,260 @@
+//
+//  ingest_benchmark.cpp
+//  photo-exif-parsing
+//
+//  Times the ingest pipeline (parseImage -> EXIFInfo::parseFrom ->
+//  addPhoto/writeCSVLine, then writeJSON) over generated corpora and prints
+//  files/s, MB/s and per-stage p50/p99 latency for every combination of
+//  corpus size and thread count. Runs offline; nothing outside the scratch
+//  directory is read or written.
+//
+//  Not part of the Xcode target. On Linux, with Boost.Filesystem installed
+//  and easyexif where the Xcode project expects it (or EASYEXIF_DIR set),
+//  benchmark/Makefile builds it:
+//
+//    make -C benchmark
+//
+//  ./ingest_benchmark --files 1000,100000 --threads 1,4,16 --size 262144
+//  ./ingest_benchmark --files 50000 --byte-order mixed --app1-offset 500000
+//      --thumbnail 12000 --depth 3 --per-dir 200 --corpus-only --dir corpus
+//
+//  Corpora are written once per size and then read with a warm page cache.
+//
+
+#include <errno.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "corpus_generator.h"
+#include "directory_walker.h"
+#include "photo_index.h"
+#include "pipeline.h"
+#include "work_stealing_pool.h"
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    enum Stage { STAGE_PARSE, STAGE_ADD, STAGE_CSV, STAGE_COUNT };
+
+    std::vector<size_t> parseList(const char *text) {
+        std::vector<size_t> values;
+        for (const char *p = text; *p; ) {
+            values.push_back((size_t)strtoull(p, nullptr, 10));
+            p = strchr(p, ',');
+            if (!p) break;
+            p++;
+        }
+        return values;
+    }
+
+    uint64_t nanosSince(Clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+
+    // pct-th percentile in microseconds; sorts samples.
+    double percentile(std::vector<uint64_t> &samples, double pct) {
+        if (samples.empty()) return 0;
+        size_t rank = std::min(samples.size() - 1, (size_t)(pct / 100 * samples.size()));
+        std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+        return samples[rank] / 1000.0;
+    }
+
+    int removeEntry(const char *path, const struct stat *, int, struct FTW *) {
+        return remove(path);
+    }
+
+    struct RunResult
+    {
+        size_t files;
+        double seconds;
+        double jsonMillis;
+        std::vector<uint64_t> samples[STAGE_COUNT];
+    };
+
+    // One full ingest of corpus with threads workers; outputs go to scratch.
+    int runIngest(const std::string &corpus, const std::string &scratch, unsigned threads, RunResult &run) {
+        photos.clear();
+        CSVWriter csv;
+        if (csv.open((scratch + "/results.csv").c_str())) return -1;
+        writeCSVHeader(csv);
+
+        WorkStealingPool pool(threads);
+        std::mutex sinkLock;
+        std::vector<std::vector<uint64_t> > perWorker(pool.size() * STAGE_COUNT);
+
+        WalkOptions options;
+        options.extensions.push_back(".jpg");
+
+        Clock::time_point start = Clock::now();
+        run.files = walkDirectory(corpus, options, [&](const std::string &fileName) {
+            pool.submit([&, fileName] {
+                std::vector<uint64_t> *samples = &perWorker[WorkStealingPool::currentWorker() * STAGE_COUNT];
+                FileKey key;
+                PhotoIndex::statKey(fileName.c_str(), key);
+
+                Clock::time_point t = Clock::now();
+                EXIFInfo result;
+                int retVal = parseImage(fileName.c_str(), result);
+                samples[STAGE_PARSE].push_back(nanosSince(t));
+                if (retVal) return;
+
+                t = Clock::now();
+                addPhoto(fileName.c_str(), result, key.size);
+                samples[STAGE_ADD].push_back(nanosSince(t));
+
+                std::lock_guard<std::mutex> guard(sinkLock);
+                t = Clock::now();
+                writeCSVLine(csv, result, fileName.c_str());
+                samples[STAGE_CSV].push_back(nanosSince(t));
+            });
+        });
+        pool.wait();
+
+        Clock::time_point jsonStart = Clock::now();
+        writeJSON((scratch + "/geojson.json").c_str(), &pool, nullptr);
+        run.jsonMillis = nanosSince(jsonStart) / 1e6;
+        int closeVal = csv.close();
+        run.seconds = nanosSince(start) / 1e9;
+
+        for (size_t w = 0; w < pool.size(); w++) {
+            for (int s = 0; s < STAGE_COUNT; s++) {
+                std::vector<uint64_t> &from = perWorker[w * STAGE_COUNT + s];
+                run.samples[s].insert(run.samples[s].end(), from.begin(), from.end());
+            }
+        }
+        return closeVal;
+    }
+}
+
+int main(int argc, const char * argv[])
+{
+    // --files and --threads take comma-separated lists; --dir picks the
+    // scratch directory, which is removed afterwards unless --keep is given.
+    // The corpus layout comes from --size (bytes per file), --gps (share of
+    // photos with a location), --byte-order little|big|mixed, --app1-offset,
+    // --makernote and --thumbnail (bytes), and --depth/--per-dir/--fanout
+    // for the directory tree. --corpus-only writes the corpora and stops.
+    std::vector<size_t> corpusSizes = parseList("1000,10000");
+    std::vector<size_t> threadCounts = parseList("1,2,4,8");
+    CorpusOptions corpusOptions;
+    std::string scratch;
+    bool keep = false;
+    bool corpusOnly = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--files") == 0 && i + 1 < argc) {
+            corpusSizes = parseList(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threadCounts = parseList(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            corpusOptions.fileSize = (size_t)strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--gps") == 0 && i + 1 < argc) {
+            corpusOptions.gpsFraction = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--byte-order") == 0 && i + 1 < argc) {
+            const char *order = argv[++i];
+            if (strcmp(order, "big") == 0) corpusOptions.byteOrder = CORPUS_BIG_ENDIAN;
+            else if (strcmp(order, "mixed") == 0) corpusOptions.byteOrder = CORPUS_MIXED_ENDIAN;
+            else corpusOptions.byteOrder = CORPUS_LITTLE_ENDIAN;
+        }
+        else if (strcmp(argv[i], "--app1-offset") == 0 && i + 1 < argc) {
+            corpusOptions.app1Offset = (size_t)strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--makernote") == 0 && i + 1 < argc) {
+            corpusOptions.makerNoteSize = (size_t)strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--thumbnail") == 0 && i + 1 < argc) {
+            corpusOptions.thumbnailSize = (size_t)strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            corpusOptions.depth = (unsigned)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--per-dir") == 0 && i + 1 < argc) {
+            corpusOptions.filesPerDirectory = (size_t)strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--fanout") == 0 && i + 1 < argc) {
+            corpusOptions.fanout = (size_t)strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--corpus-only") == 0) {
+            corpusOnly = true;
+            keep = true;
+        }
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            scratch = argv[++i];
+        }
+        else if (strcmp(argv[i], "--keep") == 0) {
+            keep = true;
+        }
+    }
+
+    if (scratch.empty()) {
+        const char *tmp = getenv("TMPDIR");
+        std::string pattern = std::string(tmp && *tmp ? tmp : "/tmp") + "/photo-bench-XXXXXX";
+        std::vector<char> name(pattern.begin(), pattern.end());
+        name.push_back('\0');
+        if (!mkdtemp(&name[0])) {
+            printf("Can't create scratch directory.\n");
+            return 1;
+        }
+        scratch = &name[0];
+    }
+    else if (mkdir(scratch.c_str(), 0755) && errno != EEXIST) {
+        printf("Can't create scratch directory.\n");
+        return 1;
+    }
+
+    if (!corpusOnly) printf("%9s %7s %10s %9s %17s %17s %17s %9s\n", "files", "threads", "files/s", "MB/s",
+           "parse p50/p99 us", "add p50/p99 us", "csv p50/p99 us", "json ms");
+
+    int status = 0;
+    for (size_t c = 0; c < corpusSizes.size() && !status; c++) {
+        char name[32];
+        snprintf(name, sizeof(name), "/corpus-%zu", corpusSizes[c]);
+        std::string corpus = scratch + name;
+
+        uint64_t corpusBytes = 0;
+        corpusOptions.count = corpusSizes[c];
+        WorkStealingPool writers;
+        if (generateCorpus(corpus, corpusOptions, &writers, &corpusBytes)) {
+            printf("Can't write corpus %s.\n", corpus.c_str());
+            status = 1;
+            break;
+        }
+        if (corpusOnly) {
+            printf("%9zu files, %.1f MB in %s\n", corpusSizes[c], corpusBytes / 1048576.0, corpus.c_str());
+            continue;
+        }
+
+        for (size_t t = 0; t < threadCounts.size(); t++) {
+            RunResult run;
+            if (runIngest(corpus, scratch, (unsigned)threadCounts[t], run)) {
+                printf("Can't write results in %s.\n", scratch.c_str());
+                status = 1;
+                break;
+            }
+
+            char stages[STAGE_COUNT][32];
+            for (int s = 0; s < STAGE_COUNT; s++) {
+                double p50 = percentile(run.samples[s], 50);
+                snprintf(stages[s], sizeof(stages[s]), "%.1f/%.1f", p50, percentile(run.samples[s], 99));
+            }
+            printf("%9zu %7zu %10.0f %9.1f %17s %17s %17s %9.1f\n", run.files, threadCounts[t],
+                   run.files / run.seconds, corpusBytes / run.seconds / (1 << 20),
+                   stages[STAGE_PARSE], stages[STAGE_ADD], stages[STAGE_CSV], run.jsonMillis);
+        }
+    }
+
+    if (!keep) nftw(scratch.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    return status;
+}
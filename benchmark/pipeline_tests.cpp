@@ -0,0 +1,707 @@
+//
+//  pipeline_tests.cpp
+//  photo-exif-parsing
+//
+//  Checks the pipeline's sorting, parsing and indexing code against brute
+//  force on random and hand-picked inputs. Prints each failed check and
+//  exits non-zero if there was one. Built next to the benchmark:
+//
+//    make -C benchmark check
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "exif_time.h"
+#include "heif_boxes.h"
+#include "image_reader.h"
+#include "photo_table.h"
+#include "radix_sort.h"
+#include "spatial_index.h"
+#include "time_index.h"
+#include "work_stealing_pool.h"
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+namespace {
+    size_t checks = 0;
+    size_t failures = 0;
+
+    void check(bool ok, const char *what, const char *file, int line) {
+        checks++;
+        if (ok) return;
+        failures++;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    }
+
+    // xorshift64*, so every run sees the same inputs.
+    class Random
+    {
+    public:
+        explicit Random(uint64_t seed) : state(seed ? seed : 1) {}
+
+        uint64_t next() {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 2685821657736338717ULL;
+        }
+
+        // Uniform in [0, bound).
+        uint64_t below(uint64_t bound) { return next() % bound; }
+        double between(double low, double high) { return low + (high - low) * (next() >> 11) * (1.0 / (1ULL << 53)); }
+
+    private:
+        uint64_t state;
+    };
+
+    // radixSortOrder must give exactly the permutation a stable comparison
+    // sort gives, with and without a pool.
+    void testRadixSort(WorkStealingPool &pool) {
+        Random random(12);
+        const size_t sizes[] = { 0, 1, 2, 3, 100, 4097, 100000 };
+        // Full-width keys, a few distinct values (stability), and keys that
+        // only differ in the low digits (skipped passes).
+        const uint64_t spreads[] = { 0, 7, 1 << 20 };
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            for (size_t k = 0; k < sizeof(spreads) / sizeof(spreads[0]); k++) {
+                std::vector<uint64_t> keys(sizes[s]);
+                for (size_t i = 0; i < keys.size(); i++) {
+                    keys[i] = spreads[k] ? 0x0123456700000000ULL + random.below(spreads[k]) : random.next();
+                }
+                std::vector<uint32_t> expected(keys.size());
+                for (size_t i = 0; i < expected.size(); i++) expected[i] = (uint32_t)i;
+                std::stable_sort(expected.begin(), expected.end(), [&](uint32_t a, uint32_t b) {
+                    return keys[a] < keys[b];
+                });
+
+                const uint64_t *data = keys.empty() ? nullptr : &keys[0];
+                std::vector<uint32_t> order;
+                radixSortOrder(data, keys.size(), order);
+                CHECK(order == expected);
+                order.clear();
+                radixSortOrder(data, keys.size(), order, &pool);
+                CHECK(order == expected);
+            }
+        }
+
+        // The key mappings keep the numeric order of signed and floating
+        // point values.
+        for (int i = 0; i < 100000; i++) {
+            int64_t a = (int64_t)random.next(), b = (int64_t)random.next();
+            if (i % 3 == 0) b = a + (int64_t)random.below(3) - 1;
+            CHECK((a < b) == (radixKey(a) < radixKey(b)));
+        }
+        const double special[] = {
+            -std::numeric_limits<double>::infinity(), -1e300, -1.5, -std::numeric_limits<double>::min(),
+            std::numeric_limits<double>::min(), 1e-300, 0.5, 1.5, 1e300, std::numeric_limits<double>::infinity()
+        };
+        const size_t specialCount = sizeof(special) / sizeof(special[0]);
+        for (int i = 0; i < 100000; i++) {
+            double a = i < 100 ? special[i % specialCount] : random.between(-1e6, 1e6);
+            double b = i < 100 ? special[i / 10 % specialCount] : random.between(-1e6, 1e6);
+            CHECK((a < b) == (radixKey(a) < radixKey(b)));
+        }
+    }
+
+    // sortedByTime orders by time, then file name, then row id.
+    void testSortedByTime(WorkStealingPool &pool) {
+        Random random(13);
+        PhotoTable photos;
+        std::vector<std::string> names;
+        for (int i = 0; i < 20000; i++) {
+            // Few distinct times, some before the epoch, so ties are common.
+            int64_t time = ((int64_t)random.below(500) - 100) * 1000000000LL;
+            char name[32];
+            snprintf(name, sizeof(name), "IMG_%04u.JPG", (unsigned)random.below(3000));
+            names.push_back(name);
+            photos.append(name, 0, 0, 0, time, 0);
+        }
+
+        std::vector<RowId> expected(photos.size());
+        for (size_t i = 0; i < expected.size(); i++) expected[i] = (RowId)i;
+        const std::vector<int64_t> &times = photos.timesTaken();
+        std::sort(expected.begin(), expected.end(), [&](RowId a, RowId b) {
+            if (times[a] != times[b]) return times[a] < times[b];
+            if (names[a] != names[b]) return names[a] < names[b];
+            return a < b;
+        });
+        CHECK(photos.sortedByTime() == expected);
+        CHECK(photos.sortedByTime(&pool) == expected);
+    }
+
+    int64_t expectedTime(int year, int month, int day, int hour, int minute, int second,
+                         int64_t offsetSeconds, int64_t nanos) {
+        struct tm fields;
+        memset(&fields, 0, sizeof(fields));
+        fields.tm_year = year - 1900;
+        fields.tm_mon = month - 1;
+        fields.tm_mday = day;
+        fields.tm_hour = hour;
+        fields.tm_min = minute;
+        fields.tm_sec = second;
+        return ((int64_t)timegm(&fields) - offsetSeconds) * 1000000000LL + nanos;
+    }
+
+    // parseExifTimestamp against timegm on random valid times, and against
+    // the inputs cameras get wrong.
+    void testTimestamps() {
+        Random random(11);
+        static const int kDays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+        static const char *const kOffsets[] = { "+09:00", "-05:30", "+0545", "-1200", "+14:00", "Z", "" };
+        static const int64_t kOffsetSeconds[] = { 32400, -19800, 20700, -43200, 50400, 0, 0 };
+        for (int i = 0; i < 100000; i++) {
+            int year = 1800 + (int)random.below(400);
+            int month = 1 + (int)random.below(12);
+            bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+            int day = 1 + (int)random.below(kDays[month - 1] + (month == 2 && leap));
+            int hour = (int)random.below(24), minute = (int)random.below(60), second = (int)random.below(61);
+            char separator = random.below(2) ? ':' : '-';
+            char text[32];
+            snprintf(text, sizeof(text), "%04d%c%02d%c%02d%c%02d:%02d:%02d", year, separator, month, separator,
+                     day, separator == '-' && random.below(2) ? 'T' : ' ', hour, minute, second);
+            size_t offset = (size_t)random.below(sizeof(kOffsets) / sizeof(kOffsets[0]));
+            unsigned fraction = (unsigned)random.below(1000);
+            char subSec[8];
+            snprintf(subSec, sizeof(subSec), "%03u", fraction);
+
+            CHECK(parseExifTimestamp(text) == expectedTime(year, month, day, hour, minute, second, 0, 0));
+            CHECK(parseExifTimestamp(text, subSec, kOffsets[offset]) ==
+                  expectedTime(year, month, day, hour, minute, second, kOffsetSeconds[offset], fraction * 1000000LL));
+        }
+
+        const char *noon = "2016:02:29 12:00:00";
+        int64_t base = expectedTime(2016, 2, 29, 12, 0, 0, 0, 0);
+        CHECK(parseExifTimestamp(noon, nullptr, nullptr) == base);
+        CHECK(parseExifTimestamp(noon, "", "") == base);
+        CHECK(parseExifTimestamp(noon, "5", nullptr) == base + 500000000LL);
+        CHECK(parseExifTimestamp(noon, "  25", nullptr) == base + 250000000LL);
+        CHECK(parseExifTimestamp(noon, "12x", nullptr) == base + 120000000LL);
+        CHECK(parseExifTimestamp(noon, "1234567891234", nullptr) == base + 123456789LL);
+        CHECK(parseExifTimestamp(noon, nullptr, "+00:30") == base - 1800 * 1000000000LL);
+
+        // Malformed offsets reject the whole time rather than guess.
+        const char *badOffsets[] = { "+15:00", "+09:60", "09:00", "+9:00", "+09:00x", "+09:", "+", "ZZ", "+09-00" };
+        for (size_t i = 0; i < sizeof(badOffsets) / sizeof(badOffsets[0]); i++) {
+            CHECK(parseExifTimestamp(noon, nullptr, badOffsets[i]) == kUnknownTime);
+        }
+
+        const char *badTimes[] = {
+            "0000:00:00 00:00:00", "    :  :     :  :  ", "", "2015:02:29 12:00:00", "2016:13:01 12:00:00",
+            "2016:00:10 12:00:00", "2016:04:31 12:00:00", "2016:01:01 24:00:00", "2016:01:01 12:60:00",
+            "2016:01:01 12:00:61", "2016:01-01 12:00:00", "2016/01/01 12:00:00", "2016:01:01_12:00:00",
+            "2016:01:01 12-00-00", "2016:1:01 12:00:00", "20160101 120000", "2016:01:01 12:00:0x"
+        };
+        for (size_t i = 0; i < sizeof(badTimes) / sizeof(badTimes[0]); i++) {
+            CHECK(parseExifTimestamp(badTimes[i]) == kUnknownTime);
+        }
+        CHECK(parseExifTimestamp((const char *)nullptr) == kUnknownTime);
+
+        // Every proper prefix is rejected; each is its own allocation so a
+        // read past the terminator shows up under a sanitizer.
+        for (size_t length = 0; length < strlen(noon); length++) {
+            std::vector<char> prefix(length + 1, '\0');
+            memcpy(&prefix[0], noon, length);
+            CHECK(parseExifTimestamp(&prefix[0]) == kUnknownTime);
+        }
+
+        ExifTimeFields batch[] = { { noon, "5", "Z" }, { "2016:13:01 00:00:00", nullptr, nullptr }, { noon, nullptr, nullptr } };
+        int64_t out[3];
+        CHECK(parseExifTimestamps(batch, 3, out) == 2);
+        CHECK(out[0] == base + 500000000LL && out[1] == kUnknownTime && out[2] == base);
+    }
+
+    // Same formula as the index, so points right on the circle agree.
+    double haversineMeters(double lat1, double lon1, double lat2, double lon2) {
+        const double toRadians = M_PI / 180.0;
+        double dLat = (lat2 - lat1) * toRadians;
+        double dLon = (lon2 - lon1) * toRadians;
+        double a = sin(dLat / 2) * sin(dLat / 2) +
+                   cos(lat1 * toRadians) * cos(lat2 * toRadians) * sin(dLon / 2) * sin(dLon / 2);
+        return 2 * 6371008.8 * asin(std::min(1.0, sqrt(a)));
+    }
+
+    std::vector<RowId> sorted(std::vector<RowId> rows) {
+        std::sort(rows.begin(), rows.end());
+        return rows;
+    }
+
+    // SpatialIndex box and radius queries against a scan of every point,
+    // over tables with clusters, duplicates and points at the poles and on
+    // the antimeridian.
+    void testSpatialIndex(WorkStealingPool &pool) {
+        Random random(14);
+        const size_t sizes[] = { 0, 1, 17, 5000 };
+        const unsigned capacities[] = { 2, 3, 16 };
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            PhotoTable photos;
+            for (size_t i = 0; i < sizes[s]; i++) {
+                double lat, lon;
+                switch (random.below(4)) {
+                    case 0: lat = random.between(-90, 90); lon = random.between(-180, 180); break;
+                    case 1: lat = 52.5 + random.between(-0.01, 0.01); lon = 13.4 + random.between(-0.01, 0.01); break;
+                    case 2: lat = random.between(-90, 90); lon = random.below(2) ? 180.0 : -180.0; break;
+                    default: lat = random.below(2) ? 89.999 : -90.0; lon = random.between(-180, 180); break;
+                }
+                photos.append("x", lat, lon, 0, 0, 0);
+                // Exact duplicates, as bursts from one spot produce.
+                if (random.below(10) == 0) photos.append("x", lat, lon, 0, 0, 0);
+            }
+            const std::vector<double> &lats = photos.latitudes();
+            const std::vector<double> &lons = photos.longitudes();
+
+            for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+                SpatialIndex index(capacities[c]);
+                index.build(photos, c == 0 ? nullptr : &pool);
+                CHECK(index.size() == photos.size());
+
+                for (int q = 0; q < 200; q++) {
+                    double lat1 = random.between(-90, 90), lat2 = random.between(-90, 90);
+                    double minLat = std::min(lat1, lat2), maxLat = std::max(lat1, lat2);
+                    double minLon = random.between(-180, 180), maxLon = random.between(-180, 180);
+                    if (q % 4 == 0)
+                    {
+                        minLat = 52.49; maxLat = 52.5 + random.between(0, 0.02);
+                        minLon = 13.39; maxLon = 13.4 + random.between(0, 0.02);
+                    }
+                    bool wraps = minLon > maxLon;
+                    std::vector<RowId> expected;
+                    for (size_t i = 0; i < photos.size(); i++) {
+                        bool inLon = wraps ? lons[i] >= minLon || lons[i] <= maxLon
+                                           : lons[i] >= minLon && lons[i] <= maxLon;
+                        if (lats[i] >= minLat && lats[i] <= maxLat && inLon) expected.push_back((RowId)i);
+                    }
+                    std::vector<RowId> rows;
+                    index.queryBox(minLat, minLon, maxLat, maxLon, rows);
+                    CHECK(sorted(rows) == expected);
+
+                    double lat, lon;
+                    switch (q % 4) {
+                        case 0: lat = 52.5; lon = 13.4; break;
+                        case 1: lat = random.between(-90, 90); lon = random.below(2) ? 179.9 : -179.9; break;
+                        case 2: lat = random.below(2) ? 89.9 : -89.9; lon = random.between(-180, 180); break;
+                        default: lat = random.between(-90, 90); lon = random.between(-180, 180); break;
+                    }
+                    double radius = pow(10.0, random.between(1, 7.3));
+                    expected.clear();
+                    for (size_t i = 0; i < photos.size(); i++) {
+                        if (haversineMeters(lat, lon, lats[i], lons[i]) <= radius) expected.push_back((RowId)i);
+                    }
+                    rows.clear();
+                    index.queryRadius(lat, lon, radius, rows);
+                    CHECK(sorted(rows) == expected);
+                }
+            }
+        }
+    }
+
+    // Non-empty buckets of width overlapping [begin, end), counted whole.
+    std::vector<TimeBucket> expectedBuckets(const std::vector<int64_t> &times, int64_t width,
+                                            int64_t begin, int64_t end) {
+        std::map<int64_t, uint32_t> counts;
+        for (size_t i = 0; i < times.size(); i++) {
+            int64_t start = times[i] / width * width;
+            if (start > times[i]) start -= width;
+            counts[start]++;
+        }
+        std::vector<TimeBucket> buckets;
+        if (begin >= end) return buckets;
+        for (std::map<int64_t, uint32_t>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+            if (it->first < end && it->first + width > begin)
+            {
+                TimeBucket bucket = { it->first, it->second };
+                buckets.push_back(bucket);
+            }
+        }
+        return buckets;
+    }
+
+    bool sameBuckets(const std::vector<TimeBucket> &a, const std::vector<TimeBucket> &b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].start != b[i].start || a[i].count != b[i].count) return false;
+        }
+        return true;
+    }
+
+    // TimeIndex range queries and day/hour rollups against a scan of the
+    // time column, with photos on both sides of the epoch.
+    void testTimeIndex(WorkStealingPool &pool) {
+        Random random(15);
+        const int64_t hour = TimeIndex::kNanosPerHour, day = TimeIndex::kNanosPerDay;
+        const size_t sizes[] = { 0, 1, 3000 };
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            PhotoTable photos;
+            for (size_t i = 0; i < sizes[s]; i++) {
+                // Sixty days around the epoch; whole hours and days are common
+                // so bucket edges get hit exactly.
+                int64_t time = (int64_t)random.below(60 * day) - 30 * day;
+                if (random.below(4) == 0) time -= time % hour;
+                photos.append("x", 0, 0, 0, time, 0);
+            }
+            const std::vector<int64_t> &times = photos.timesTaken();
+
+            TimeIndex index;
+            index.build(photos, s % 2 ? &pool : nullptr);
+            CHECK(index.size() == photos.size());
+            std::vector<int64_t> ordered(times);
+            std::sort(ordered.begin(), ordered.end());
+            CHECK(index.sortedTimes() == ordered);
+            CHECK(index.sortedRows() == photos.sortedByTime());
+
+            for (int q = 0; q < 500; q++) {
+                int64_t begin = (int64_t)random.below(70 * day) - 35 * day;
+                int64_t end = begin + (int64_t)random.below(10 * day) - day;
+                if (q % 5 == 0) begin -= begin % day;
+                if (q % 7 == 0) end -= end % hour;
+                if (q == 0) begin = INT64_MIN;
+                if (q == 1) end = INT64_MAX;
+                if (q == 2) { begin = INT64_MIN; end = INT64_MAX; }
+
+                std::vector<RowId> expected;
+                const std::vector<RowId> &byTime = index.sortedRows();
+                for (size_t i = 0; i < byTime.size(); i++) {
+                    int64_t t = times[byTime[i]];
+                    if (t >= begin && t < end) expected.push_back(byTime[i]);
+                }
+                std::vector<RowId> rows;
+                index.rowsBetween(begin, end, rows);
+                CHECK(rows == expected);
+                CHECK(index.countBetween(begin, end) == expected.size());
+
+                CHECK(sameBuckets(index.days(begin, end), expectedBuckets(times, day, begin, end)));
+                CHECK(sameBuckets(index.hours(begin, end), expectedBuckets(times, hour, begin, end)));
+            }
+            CHECK(sameBuckets(index.days(), expectedBuckets(times, day, INT64_MIN, INT64_MAX)));
+        }
+    }
+
+    typedef std::vector<unsigned char> Bytes;
+
+    void putBigEndian(Bytes &out, uint64_t value, unsigned size) {
+        for (unsigned i = size; i > 0; i--) out.push_back((unsigned char)(value >> (8 * (i - 1))));
+    }
+
+    Bytes box(const char *type, const Bytes &contents) {
+        Bytes out;
+        putBigEndian(out, contents.size() + 8, 4);
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), contents.begin(), contents.end());
+        return out;
+    }
+
+    void putFullBoxHeader(Bytes &out, unsigned version) {
+        putBigEndian(out, version, 1);
+        putBigEndian(out, 0, 3);
+    }
+
+    struct HeifItem
+    {
+        uint32_t id;
+        const char *type;
+        unsigned infeVersion;
+        bool located;
+        unsigned constructionMethod;
+        unsigned dataReference;
+        uint64_t baseOffset;
+        std::vector<HeifExtent> extents;
+    };
+
+    uint64_t fitting(Random &random, unsigned size) {
+        if (size == 0) return 0;
+        uint64_t value = random.next();
+        return size == 8 ? value >> 1 : value & 0xffffffffULL;
+    }
+
+    // Builds the contents of a random meta box (after its header) and
+    // works out what findHeifExifItem should find there. Returns false in
+    // expected when the Exif item can't be located.
+    Bytes randomMeta(Random &random, uint64_t metaOffset, bool &found, std::vector<HeifExtent> &expected) {
+        unsigned ilocVersion = (unsigned)random.below(3);
+        const unsigned fieldSizes[] = { 0, 4, 8 };
+        unsigned offsetSize = fieldSizes[random.below(3)];
+        unsigned lengthSize = random.below(8) ? fieldSizes[1 + random.below(2)] : 0;
+        unsigned baseOffsetSize = fieldSizes[random.below(3)];
+        unsigned indexSize = ilocVersion >= 1 ? fieldSizes[random.below(3)] : 0;
+
+        std::vector<HeifItem> items(1 + random.below(5));
+        size_t exifAt = random.below(4) ? (size_t)random.below(items.size()) : items.size();
+        for (size_t i = 0; i < items.size(); i++) {
+            HeifItem &item = items[i];
+            item.id = (uint32_t)(1 + i * 1000 + random.below(1000));
+            item.type = i == exifAt ? "Exif" : (random.below(2) ? "hvc1" : "mime");
+            item.infeVersion = i == exifAt && random.below(10) == 0 ? 1 : 2 + (unsigned)random.below(2);
+            item.located = i != exifAt || random.below(10) != 0;
+            item.constructionMethod = ilocVersion >= 1 ? (unsigned)random.below(5) % 3 : 0;
+            item.dataReference = random.below(10) == 0 ? 1 : 0;
+            item.baseOffset = fitting(random, baseOffsetSize);
+            item.extents.resize(random.below(4) ? 1 : 1 + random.below(3));
+            for (size_t e = 0; e < item.extents.size(); e++) {
+                item.extents[e].offset = fitting(random, offsetSize);
+                item.extents[e].length = fitting(random, lengthSize);
+            }
+        }
+
+        Bytes infeBoxes;
+        for (size_t i = 0; i < items.size(); i++) {
+            const HeifItem &item = items[i];
+            Bytes infe;
+            putFullBoxHeader(infe, item.infeVersion);
+            putBigEndian(infe, item.id, item.infeVersion == 3 ? 4 : 2);
+            putBigEndian(infe, 0, 2);
+            if (item.infeVersion >= 2) infe.insert(infe.end(), item.type, item.type + 4);
+            infe.push_back(0);
+            Bytes entry = box("infe", infe);
+            infeBoxes.insert(infeBoxes.end(), entry.begin(), entry.end());
+        }
+        Bytes iinf;
+        unsigned iinfVersion = (unsigned)random.below(2);
+        putFullBoxHeader(iinf, iinfVersion);
+        putBigEndian(iinf, items.size(), iinfVersion == 0 ? 2 : 4);
+        iinf.insert(iinf.end(), infeBoxes.begin(), infeBoxes.end());
+
+        Bytes iloc;
+        putFullBoxHeader(iloc, ilocVersion);
+        putBigEndian(iloc, offsetSize << 4 | lengthSize, 1);
+        putBigEndian(iloc, baseOffsetSize << 4 | indexSize, 1);
+        size_t located = 0;
+        for (size_t i = 0; i < items.size(); i++) located += items[i].located;
+        putBigEndian(iloc, located, ilocVersion < 2 ? 2 : 4);
+        for (size_t i = 0; i < items.size(); i++) {
+            const HeifItem &item = items[i];
+            if (!item.located) continue;
+            putBigEndian(iloc, item.id, ilocVersion < 2 ? 2 : 4);
+            if (ilocVersion >= 1) putBigEndian(iloc, item.constructionMethod, 2);
+            putBigEndian(iloc, item.dataReference, 2);
+            putBigEndian(iloc, item.baseOffset, baseOffsetSize);
+            putBigEndian(iloc, item.extents.size(), 2);
+            for (size_t e = 0; e < item.extents.size(); e++) {
+                putBigEndian(iloc, random.next(), indexSize);
+                putBigEndian(iloc, item.extents[e].offset, offsetSize);
+                putBigEndian(iloc, item.extents[e].length, lengthSize);
+            }
+        }
+
+        Bytes hdlr;
+        putFullBoxHeader(hdlr, 0);
+        putBigEndian(hdlr, 0, 4);
+        hdlr.insert(hdlr.end(), "pict", "pict" + 4);
+        hdlr.insert(hdlr.end(), 13, 0);
+        Bytes idat(random.below(64), 0xAA);
+        bool haveIdat = random.below(4) != 0;
+
+        // Children in a random order; hdlr conventionally comes first.
+        std::vector<Bytes> children;
+        children.push_back(box("hdlr", hdlr));
+        children.push_back(box("iinf", iinf));
+        children.push_back(box("iloc", iloc));
+        if (haveIdat) children.push_back(box("idat", idat));
+        for (size_t i = children.size() - 1; i > 1; i--) std::swap(children[i], children[1 + random.below(i)]);
+
+        Bytes meta;
+        putFullBoxHeader(meta, 0);
+        uint64_t idatOffset = 0;
+        for (size_t i = 0; i < children.size(); i++) {
+            if (memcmp(&children[i][4], "idat", 4) == 0) idatOffset = metaOffset + meta.size() + 8;
+            meta.insert(meta.end(), children[i].begin(), children[i].end());
+        }
+
+        found = false;
+        expected.clear();
+        if (exifAt == items.size()) return meta;
+        const HeifItem &exif = items[exifAt];
+        if (exif.infeVersion < 2 || !exif.located || exif.dataReference != 0) return meta;
+        if (exif.constructionMethod > 1 || (exif.constructionMethod == 1 && !haveIdat)) return meta;
+        for (size_t e = 0; e < exif.extents.size(); e++) {
+            if (exif.extents[e].length == 0) return meta;
+            HeifExtent extent = { exif.baseOffset + exif.extents[e].offset, exif.extents[e].length };
+            if (exif.constructionMethod == 1) extent.offset += idatOffset;
+            expected.push_back(extent);
+        }
+        found = true;
+        return meta;
+    }
+
+    bool sameExtents(const std::vector<HeifExtent> &a, const std::vector<HeifExtent> &b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].offset != b[i].offset || a[i].length != b[i].length) return false;
+        }
+        return true;
+    }
+
+    // The box header reader, the brand check and the iinf/iloc walk
+    // against generated meta boxes whose Exif item location is known.
+    void testHeifBoxes() {
+        const unsigned char plain[] = { 0, 0, 0, 24, 'f', 't', 'y', 'p' };
+        const unsigned char large[] = { 0, 0, 0, 1, 'm', 'd', 'a', 't', 0, 0, 0, 1, 0, 0, 0, 0 };
+        const unsigned char toEnd[] = { 0, 0, 0, 0, 'm', 'd', 'a', 't' };
+        const unsigned char tiny[] = { 0, 0, 0, 7, 'f', 'r', 'e', 'e' };
+        IsoBox header;
+        CHECK(readBoxHeader(plain, sizeof(plain), 100, header) && header.type == fourCC("ftyp") &&
+              header.size == 24 && header.headerSize == 8);
+        CHECK(!readBoxHeader(plain, sizeof(plain), 23, header));
+        CHECK(!readBoxHeader(plain, 7, 100, header));
+        CHECK(readBoxHeader(large, sizeof(large), 1ULL << 40, header) && header.size == 1ULL << 32 &&
+              header.headerSize == 16);
+        CHECK(!readBoxHeader(large, 15, 1ULL << 40, header));
+        CHECK(readBoxHeader(toEnd, sizeof(toEnd), 5000, header) && header.size == 5000);
+        CHECK(!readBoxHeader(tiny, sizeof(tiny), 100, header));
+
+        const char *brands[] = { "heic", "heix", "mif1", "avif", "isom", "mp42", "jpeg" };
+        for (size_t i = 0; i < sizeof(brands) / sizeof(brands[0]); i++) {
+            unsigned char head[12] = { 0, 0, 0, 24, 'f', 't', 'y', 'p' };
+            memcpy(head + 8, brands[i], 4);
+            CHECK(isHeifFile(head, sizeof(head)) == (i < 4));
+            CHECK(!isHeifFile(head, 11));
+        }
+
+        Random random(24);
+        size_t foundCount = 0;
+        for (int i = 0; i < 20000; i++) {
+            uint64_t metaOffset = 32 + random.below(100000);
+            bool found;
+            std::vector<HeifExtent> expected, extents;
+            Bytes meta = randomMeta(random, metaOffset, found, expected);
+            CHECK(findHeifExifItem(&meta[0], meta.size(), metaOffset, extents) == found);
+            if (found) CHECK(sameExtents(extents, expected));
+            else CHECK(extents.empty());
+            foundCount += found;
+
+            // Cut short anywhere, the walk stays inside the bytes it got.
+            if (i % 20 == 0)
+            {
+                for (size_t length = 0; length < meta.size(); length++) {
+                    Bytes cut(meta.begin(), meta.begin() + length);
+                    if (!findHeifExifItem(cut.empty() ? nullptr : &cut[0], cut.size(), metaOffset, extents))
+                    {
+                        CHECK(extents.empty());
+                    }
+                }
+            }
+        }
+        // Both outcomes have to be exercised for the comparison to mean much.
+        CHECK(foundCount > 2000 && foundCount < 18000);
+    }
+
+    // A HEIC file whose one Exif item has a single extent at offset with
+    // length, followed by an mdat holding a minimal Exif item. A zero
+    // offset points the extent at that item.
+    Bytes heifFile(uint64_t offset, uint64_t length) {
+        Bytes ftyp;
+        ftyp.insert(ftyp.end(), "heic", "heic" + 4);
+        putBigEndian(ftyp, 0, 4);
+        ftyp.insert(ftyp.end(), "mif1", "mif1" + 4);
+
+        Bytes infe;
+        putFullBoxHeader(infe, 2);
+        putBigEndian(infe, 1, 2);
+        putBigEndian(infe, 0, 2);
+        infe.insert(infe.end(), "Exif", "Exif" + 4);
+        infe.push_back(0);
+        Bytes iinf;
+        putFullBoxHeader(iinf, 0);
+        putBigEndian(iinf, 1, 2);
+        Bytes entry = box("infe", infe);
+        iinf.insert(iinf.end(), entry.begin(), entry.end());
+
+        // Tiff header offset, "Exif\0\0", then an empty little-endian IFD0.
+        const unsigned char item[] = {
+            0, 0, 0, 0, 'E', 'x', 'i', 'f', 0, 0, 'I', 'I', 42, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0, 0
+        };
+        Bytes ftypBox = box("ftyp", ftyp), meta;
+        for (int pass = 0; pass < 2; pass++) {
+            Bytes iloc;
+            putFullBoxHeader(iloc, 1);
+            putBigEndian(iloc, 8 << 4 | 8, 1);
+            putBigEndian(iloc, 0, 1);
+            putBigEndian(iloc, 1, 2);
+            putBigEndian(iloc, 1, 2);
+            putBigEndian(iloc, 0, 2);
+            putBigEndian(iloc, 0, 2);
+            putBigEndian(iloc, 1, 2);
+            // The box sizes don't depend on the values, so the first pass
+            // finds where mdat's contents start.
+            putBigEndian(iloc, offset ? offset : ftypBox.size() + meta.size() + 8, 8);
+            putBigEndian(iloc, offset ? length : sizeof(item), 8);
+
+            Bytes contents;
+            putFullBoxHeader(contents, 0);
+            Bytes iinfBox = box("iinf", iinf), ilocBox = box("iloc", iloc);
+            contents.insert(contents.end(), iinfBox.begin(), iinfBox.end());
+            contents.insert(contents.end(), ilocBox.begin(), ilocBox.end());
+            meta = box("meta", contents);
+        }
+
+        Bytes file(ftypBox);
+        file.insert(file.end(), meta.begin(), meta.end());
+        Bytes mdat = box("mdat", Bytes(item, item + sizeof(item)));
+        file.insert(file.end(), mdat.begin(), mdat.end());
+        return file;
+    }
+
+    bool holdsExif(const ReadBuffer &buffer) {
+        return buffer.size() > 10 && memcmp(buffer.data() + 6, "Exif", 4) == 0;
+    }
+
+    // Extents from iloc are file-controlled 64-bit values; ones that wrap
+    // or run past the file must come back as "no Exif" in every read mode,
+    // and a sanitizer build must see no out-of-bounds read.
+    void testHeifExtentBounds() {
+        const uint64_t cases[][2] = {
+            { 0, 0 },
+            { 0xFFFFFFFFFFFFFFF6ULL, 100 },
+            { 0xFFFFFFFFFFFFFFFFULL, 1 },
+            { 40, 0xFFFFFFFFFFFFFFF0ULL },
+            { 200, 100 },
+        };
+        char path[] = "/tmp/pipeline_tests_XXXXXX";
+        int fd = mkstemp(path);
+        CHECK(fd >= 0);
+        if (fd < 0) return;
+        close(fd);
+
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+            Bytes file = heifFile(cases[i][0], cases[i][1]);
+            bool valid = i == 0;
+
+            ReadBuffer buffer;
+            CHECK(extractExifSegment(&file[0], file.size(), true, buffer));
+            CHECK(holdsExif(buffer) == valid);
+            buffer.clear();
+            if (extractExifSegment(&file[0], file.size(), false, buffer)) CHECK(holdsExif(buffer) == valid);
+
+            FILE *fp = fopen(path, "wb");
+            CHECK(fp && fwrite(&file[0], 1, file.size(), fp) == file.size());
+            if (fp) fclose(fp);
+            buffer.clear();
+            CHECK(readImageHeader(path, buffer) == 0);
+            CHECK(holdsExif(buffer) == valid);
+        }
+        unlink(path);
+    }
+}
+
+int main() {
+    WorkStealingPool pool(4);
+
+    testRadixSort(pool);
+    testSortedByTime(pool);
+    testTimestamps();
+    testSpatialIndex(pool);
+    testTimeIndex(pool);
+    testHeifBoxes();
+    testHeifExtentBounds();
+
+    printf("%zu checks, %zu failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+//
+//  bounded_queue.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__bounded_queue__
+#define __photo_exif_parsing__bounded_queue__
+
+#include <stddef.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "metrics.h"
+
+// Multi-producer, multi-consumer FIFO that holds at most maxItems entries
+// and maxBytes of payload, as declared by whoever pushes. A full queue
+// blocks its producers, which is how a slow stage holds back the ones
+// feeding it. One entry is always let in when the queue is empty, however
+// large, so an oversized file slows the pipeline down but can't wedge it.
+//
+// Occupancy and blocked time go to the metrics gauge for queue.
+template <typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(MetricQueue queue, size_t maxItems, size_t maxBytes = (size_t)-1)
+    : queue(queue), maxItems(maxItems ? maxItems : 1), maxBytes(maxBytes), bytes(0), closed(false) {
+        setQueueCapacity(queue, this->maxItems, maxBytes == (size_t)-1 ? 0 : maxBytes);
+    }
+
+    // Blocks while the queue is full. Returns false, dropping item, once
+    // the queue has been closed.
+    bool push(T item, size_t size = 0) {
+        std::unique_lock<std::mutex> guard(lock);
+        if (!closed && full(size))
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            while (!closed && full(size)) notFull.wait(guard);
+            recordQueueWait(queue, true, nanosSince(start));
+        }
+        if (closed) return false;
+
+        entries.push_back(Entry(std::move(item), size));
+        bytes += size;
+        recordQueueLevel(queue, entries.size(), bytes);
+        guard.unlock();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Blocks until there is an entry to take. Returns false once the queue
+    // is closed and drained.
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> guard(lock);
+        if (entries.empty() && !closed)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            while (entries.empty() && !closed) notEmpty.wait(guard);
+            recordQueueWait(queue, false, nanosSince(start));
+        }
+        if (entries.empty()) return false;
+
+        item = std::move(entries.front().item);
+        bytes -= entries.front().size;
+        entries.pop_front();
+        recordQueueLevel(queue, entries.size(), bytes);
+        guard.unlock();
+        notFull.notify_all();
+        return true;
+    }
+
+    // No more pushes; consumers drain what is left and then see false.
+    void close() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+        }
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+    bool empty() {
+        std::lock_guard<std::mutex> guard(lock);
+        return entries.empty();
+    }
+
+private:
+    struct Entry
+    {
+        Entry(T item, size_t size) : item(std::move(item)), size(size) {}
+        T item;
+        size_t size;
+    };
+
+    bool full(size_t size) const {
+        if (entries.empty()) return false;
+        return entries.size() >= maxItems || bytes + size > maxBytes;
+    }
+
+    static uint64_t nanosSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    MetricQueue queue;
+    size_t maxItems;
+    size_t maxBytes;
+    size_t bytes;
+    bool closed;
+    std::deque<Entry> entries;
+    std::mutex lock;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+
+    BoundedQueue(const BoundedQueue &);
+    BoundedQueue &operator=(const BoundedQueue &);
+};
+
+#endif /* defined(__photo_exif_parsing__bounded_queue__) */
@@ -0,0 +1,308 @@
+//
+//  buffer_pool.cpp
+//  photo-exif-parsing
+//
+
+#include "buffer_pool.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace {
+    const size_t kPageSize = 4096;
+    const int kMinClassShift = 12;      // 4 KB
+    const int kClassCount = 15;         // up to 64 MB
+
+    // A thread keeps up to this many bytes of free blocks across all
+    // classes. On top of that it keeps one spare block, the largest class it
+    // has itself acquired, so a thread reading multi-megabyte files reuses
+    // its own buffer whatever their size. Other blocks, and those freed by
+    // threads that never ask for their class, go to the depot. The pool
+    // limit bounds the free blocks in thread caches and the depot together;
+    // a spare is left out of it, since its thread just had it in use and
+    // will again, and joins the depot like the rest when the thread exits.
+    const size_t kThreadCacheBytes = 4 << 20;
+    const size_t kDefaultPoolLimit = 64 << 20;
+
+    std::atomic<size_t> pooledBytes(0);
+    std::atomic<size_t> poolLimit(kDefaultPoolLimit);
+
+    // Counts size more free bytes, less the freed bytes they replace,
+    // against the pool limit; false if they don't fit.
+    bool reservePooled(size_t size, size_t freed = 0) {
+        size_t current = pooledBytes.load(std::memory_order_relaxed);
+        do {
+            if (current - freed + size > poolLimit.load(std::memory_order_relaxed)) return false;
+        } while (!pooledBytes.compare_exchange_weak(current, current - freed + size, std::memory_order_relaxed));
+        return true;
+    }
+
+    void unreservePooled(size_t size) {
+        pooledBytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+
+    size_t classSize(int sizeClass) {
+        return (size_t)1 << (kMinClassShift + sizeClass);
+    }
+
+    // Smallest class holding count bytes, or -1 when none does.
+    int classFor(size_t count) {
+        for (int c = 0; c < kClassCount; c++) {
+            if (count <= classSize(c)) return c;
+        }
+        return -1;
+    }
+
+    struct Depot
+    {
+        Depot() : bytes(0) {}
+
+        std::mutex lock;
+        std::vector<unsigned char *> blocks[kClassCount];
+        size_t bytes;
+    };
+
+    Depot &depot() {
+        // Never destroyed, so threads exiting during shutdown can still
+        // hand their blocks back.
+        static Depot *shared = new Depot;
+        return *shared;
+    }
+
+    void freeBlock(unsigned char *block, size_t size) {
+        free(block);
+        adjustGauge(GAUGE_BUFFER_BYTES_CACHED, -(int64_t)size);
+    }
+
+    // Pushes block to the depot. When the pool is full it takes the place of
+    // a depot block one class down, which it can stand in for, or is freed.
+    void toDepot(int sizeClass, unsigned char *block) {
+        Depot &shared = depot();
+        size_t size = classSize(sizeClass);
+        unsigned char *dropped = block;
+        size_t droppedSize = size;
+        {
+            std::lock_guard<std::mutex> guard(shared.lock);
+            if (reservePooled(size)) dropped = nullptr;
+            else if (sizeClass > 0 && !shared.blocks[sizeClass - 1].empty() &&
+                     reservePooled(size, classSize(sizeClass - 1)))
+            {
+                dropped = shared.blocks[sizeClass - 1].back();
+                droppedSize = classSize(sizeClass - 1);
+                shared.blocks[sizeClass - 1].pop_back();
+                shared.bytes -= droppedSize;
+            }
+            if (dropped != block)
+            {
+                shared.blocks[sizeClass].push_back(block);
+                shared.bytes += size;
+            }
+        }
+        if (dropped) freeBlock(dropped, droppedSize);
+    }
+
+    // Frees depot blocks, largest first, until the pool fits its limit.
+    void trimDepot() {
+        Depot &shared = depot();
+        std::lock_guard<std::mutex> guard(shared.lock);
+        for (int c = kClassCount - 1; c >= 0; c--) {
+            std::vector<unsigned char *> &cached = shared.blocks[c];
+            while (!cached.empty() && pooledBytes.load(std::memory_order_relaxed) > poolLimit.load(std::memory_order_relaxed)) {
+                freeBlock(cached.back(), classSize(c));
+                cached.pop_back();
+                shared.bytes -= classSize(c);
+                unreservePooled(classSize(c));
+            }
+        }
+    }
+
+    struct ThreadCache
+    {
+        ThreadCache() : bytes(0), spare(nullptr), spareClass(-1) {
+            for (int c = 0; c < kClassCount; c++) acquires[c] = false;
+        }
+
+        std::vector<unsigned char *> blocks[kClassCount];
+        size_t bytes;
+        // Classes this thread has asked for.
+        bool acquires[kClassCount];
+        // The block kept beyond the byte budget, if any.
+        unsigned char *spare;
+        int spareClass;
+
+        ~ThreadCache() {
+            for (int c = 0; c < kClassCount; c++) {
+                for (size_t i = 0; i < blocks[c].size(); i++) {
+                    unreservePooled(classSize(c));
+                    toDepot(c, blocks[c][i]);
+                }
+            }
+            if (spare) toDepot(spareClass, spare);
+        }
+    };
+
+    thread_local ThreadCache cache;
+
+    // A cached block of sizeClass, or of the class above when there is none,
+    // so a run of files straddling a class boundary keeps reusing the larger
+    // blocks instead of allocating both sizes.
+    unsigned char *takeCached(int sizeClass, size_t &size) {
+        int last = std::min(sizeClass + 1, kClassCount - 1);
+        for (int c = sizeClass; c <= last; c++) {
+            std::vector<unsigned char *> &local = cache.blocks[c];
+            if (local.empty()) continue;
+            unsigned char *block = local.back();
+            local.pop_back();
+            size = classSize(c);
+            cache.bytes -= size;
+            unreservePooled(size);
+            return block;
+        }
+        if (cache.spare && cache.spareClass >= sizeClass && cache.spareClass <= last)
+        {
+            unsigned char *block = cache.spare;
+            size = classSize(cache.spareClass);
+            cache.spare = nullptr;
+            cache.spareClass = -1;
+            return block;
+        }
+        Depot &shared = depot();
+        std::lock_guard<std::mutex> guard(shared.lock);
+        for (int c = sizeClass; c <= last; c++) {
+            std::vector<unsigned char *> &cached = shared.blocks[c];
+            if (cached.empty()) continue;
+            unsigned char *block = cached.back();
+            cached.pop_back();
+            size = classSize(c);
+            shared.bytes -= size;
+            unreservePooled(size);
+            return block;
+        }
+        return nullptr;
+    }
+
+    unsigned char *acquireBlock(size_t count, size_t &size) {
+        int sizeClass = classFor(count);
+        size = sizeClass < 0 ? (count + kPageSize - 1) & ~(kPageSize - 1) : classSize(sizeClass);
+
+        unsigned char *block = nullptr;
+        if (sizeClass >= 0)
+        {
+            cache.acquires[sizeClass] = true;
+            block = takeCached(sizeClass, size);
+        }
+
+        if (block)
+        {
+            countMetric(COUNT_BUFFER_HITS);
+            adjustGauge(GAUGE_BUFFER_BYTES_CACHED, -(int64_t)size);
+        }
+        else
+        {
+            void *fresh = nullptr;
+            if (posix_memalign(&fresh, kPageSize, size) != 0) abort();
+            block = static_cast<unsigned char *>(fresh);
+            countMetric(COUNT_BUFFER_MISSES);
+        }
+        adjustGauge(GAUGE_BUFFER_BYTES_IN_USE, (int64_t)size);
+        return block;
+    }
+
+    void releaseBlock(unsigned char *block, size_t size) {
+        adjustGauge(GAUGE_BUFFER_BYTES_IN_USE, -(int64_t)size);
+        adjustGauge(GAUGE_BUFFER_BYTES_CACHED, (int64_t)size);
+
+        int sizeClass = classFor(size);
+        if (sizeClass < 0 || classSize(sizeClass) != size)
+        {
+            freeBlock(block, size);
+            return;
+        }
+        if (cache.bytes + size <= kThreadCacheBytes && reservePooled(size))
+        {
+            cache.blocks[sizeClass].push_back(block);
+            cache.bytes += size;
+            return;
+        }
+        if (cache.acquires[sizeClass] && sizeClass > cache.spareClass)
+        {
+            // The smaller spare it replaces is still useful to others.
+            if (cache.spare) toDepot(cache.spareClass, cache.spare);
+            cache.spare = block;
+            cache.spareClass = sizeClass;
+            return;
+        }
+        toDepot(sizeClass, block);
+    }
+}
+
+size_t setBufferPoolLimit(size_t bytes) {
+    size_t previous = poolLimit.exchange(bytes);
+    if (bytes < previous) trimDepot();
+    return previous;
+}
+
+ReadBuffer::ReadBuffer(ReadBuffer &&other)
+: bytes(other.bytes), length(other.length), room(other.room)
+{
+    other.bytes = nullptr;
+    other.length = 0;
+    other.room = 0;
+}
+
+ReadBuffer &ReadBuffer::operator=(ReadBuffer &&other) {
+    if (this != &other)
+    {
+        release();
+        bytes = other.bytes;
+        length = other.length;
+        room = other.room;
+        other.bytes = nullptr;
+        other.length = 0;
+        other.room = 0;
+    }
+    return *this;
+}
+
+void ReadBuffer::resize(size_t count) {
+    if (count > room)
+    {
+        size_t size;
+        unsigned char *block = acquireBlock(count, size);
+        if (length) memcpy(block, bytes, length);
+        if (bytes) releaseBlock(bytes, room);
+        bytes = block;
+        room = size;
+    }
+    length = count;
+}
+
+void ReadBuffer::reserve(size_t count) {
+    size_t keep = length;
+    if (count > room) resize(count);
+    length = keep;
+}
+
+void ReadBuffer::append(const unsigned char *from, size_t count) {
+    if (!count) return;
+    size_t at = length;
+    resize(length + count);
+    memcpy(bytes + at, from, count);
+}
+
+void ReadBuffer::assign(const unsigned char *from, size_t count) {
+    length = 0;
+    append(from, count);
+}
+
+void ReadBuffer::release() {
+    if (bytes) releaseBlock(bytes, room);
+    bytes = nullptr;
+    length = 0;
+    room = 0;
+}
@@ -0,0 +1,69 @@
+//
+//  buffer_pool.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__buffer_pool__
+#define __photo_exif_parsing__buffer_pool__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Page-aligned byte buffer whose storage comes from a pool of power-of-two
+// size classes (4 KB to 64 MB) rather than from malloc. Each thread keeps up
+// to 4 MB of free blocks, plus one spare block of the largest class it has
+// asked for, so a thread reading multi-megabyte files keeps reusing its own
+// buffer. Other blocks go to a shared depot that other threads refill from,
+// so buffers read on one thread and freed on another still get reused. A
+// request may be served from the class above its own. Free blocks other
+// than the spares stay under the pool limit (64 MB unless set); anything
+// past it, and any block above the largest class, goes straight back to
+// malloc.
+//
+// Acquisitions served from a thread cache or the depot count as
+// bufferHits, new blocks as bufferMisses; the bytes held by live buffers
+// are the bufferBytesInUse gauge.
+//
+// Unlike std::vector, growing never zero-fills: bytes past the old size
+// are unspecified until written.
+class ReadBuffer
+{
+public:
+    ReadBuffer() : bytes(nullptr), length(0), room(0) {}
+    ~ReadBuffer() { release(); }
+
+    ReadBuffer(ReadBuffer &&other);
+    ReadBuffer &operator=(ReadBuffer &&other);
+
+    unsigned char *data() { return bytes; }
+    const unsigned char *data() const { return bytes; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    size_t capacity() const { return room; }
+
+    // Keeps the first min(size(), count) bytes, moving to a larger block
+    // when count doesn't fit.
+    void resize(size_t count);
+    void reserve(size_t count);
+    void clear() { length = 0; }
+    void append(const unsigned char *from, size_t count);
+    void assign(const unsigned char *from, size_t count);
+
+    // Hands the block back to the pool; the buffer is empty afterwards.
+    void release();
+
+private:
+    unsigned char *bytes;
+    size_t length;
+    size_t room;
+
+    ReadBuffer(const ReadBuffer &);
+    ReadBuffer &operator=(const ReadBuffer &);
+};
+
+// Caps the bytes of free blocks the pool keeps cached across all threads
+// and returns the previous cap. Lowering it frees depot blocks right away;
+// blocks already in thread caches count until they are reused.
+size_t setBufferPoolLimit(size_t bytes);
+
+#endif /* defined(__photo_exif_parsing__buffer_pool__) */
@@ -0,0 +1,266 @@
+//
+//  columnar_writer.cpp
+//  photo-exif-parsing
+//
+
+#include "columnar_writer.h"
+
+#include <string.h>
+#include <cmath>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "columnar_writer writes native integers and assumes a little-endian host"
+#endif
+
+namespace {
+    const char kColumnarMagic[8] = { 'P', 'H', 'O', 'T', 'O', 'C', 'O', 'L' };
+    const uint32_t kColumnarVersion = 1;
+
+    enum ColumnIndex
+    {
+        COL_FILE_NAME, COL_TIME_TAKEN, COL_LATITUDE, COL_LONGITUDE, COL_ALTITUDE,
+        COL_FILE_SIZE, COL_WIDTH, COL_HEIGHT, COL_ISO, COL_ORIENTATION,
+        COL_FNUMBER, COL_EXPOSURE_TIME, COL_SOFTWARE, COL_MAKE, COL_MODEL
+    };
+
+    template <typename T>
+    void appendValue(std::vector<char> &out, const T &value) {
+        const char *bytes = reinterpret_cast<const char *>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+}
+
+ColumnarWriter::ColumnarWriter(size_t rowsPerGroup)
+: fp(nullptr), position(0), failed(false), rowsPerGroup(rowsPerGroup ? rowsPerGroup : 1), rows(0)
+{
+    addColumn("fileName", COLUMN_STRING);
+    addColumn("timeTaken", COLUMN_INT64);
+    addColumn("latitude", COLUMN_FLOAT64);
+    addColumn("longitude", COLUMN_FLOAT64);
+    addColumn("altitude", COLUMN_FLOAT64);
+    addColumn("fileSize", COLUMN_UINT64);
+    addColumn("width", COLUMN_UINT32);
+    addColumn("height", COLUMN_UINT32);
+    addColumn("iso", COLUMN_UINT16);
+    addColumn("orientation", COLUMN_UINT16);
+    addColumn("fNumber", COLUMN_FLOAT64);
+    addColumn("exposureTime", COLUMN_FLOAT64);
+    addColumn("software", COLUMN_DICTIONARY);
+    addColumn("make", COLUMN_DICTIONARY);
+    addColumn("model", COLUMN_DICTIONARY);
+}
+
+ColumnarWriter::~ColumnarWriter() {
+    close();
+}
+
+void ColumnarWriter::addColumn(const char *name, ColumnType type) {
+    Column column;
+    column.name = name;
+    column.type = type;
+    column.nulls = 0;
+    column.hasRange = false;
+    column.minInt = column.maxInt = 0;
+    column.minFloat = column.maxFloat = 0;
+    columns.push_back(column);
+}
+
+int ColumnarWriter::open(const char *fileName) {
+    close();
+    fp = fopen(fileName, "wb");
+    if (!fp) return -1;
+    position = 0;
+    failed = false;
+    rows = 0;
+    rowGroups.clear();
+    for (size_t i = 0; i < columns.size(); i++) {
+        columns[i].codes.clear();
+        columns[i].dictionary.clear();
+    }
+    writeBytes(kColumnarMagic, sizeof(kColumnarMagic));
+    return 0;
+}
+
+void ColumnarWriter::putInt(Column &column, int64_t value, bool isNull) {
+    appendValue(column.data, value);
+    if (isNull)
+    {
+        column.nulls++;
+        return;
+    }
+    if (!column.hasRange || value < column.minInt) column.minInt = value;
+    if (!column.hasRange || value > column.maxInt) column.maxInt = value;
+    column.hasRange = true;
+}
+
+void ColumnarWriter::putUnsigned(Column &column, uint64_t value, size_t width) {
+    if (width == 8) appendValue(column.data, value);
+    else if (width == 4) appendValue(column.data, (uint32_t)value);
+    else appendValue(column.data, (uint16_t)value);
+
+    int64_t asInt = (int64_t)value;
+    if (!column.hasRange || asInt < column.minInt) column.minInt = asInt;
+    if (!column.hasRange || asInt > column.maxInt) column.maxInt = asInt;
+    column.hasRange = true;
+}
+
+void ColumnarWriter::putFloat(Column &column, double value) {
+    appendValue(column.data, value);
+    if (std::isnan(value))
+    {
+        column.nulls++;
+        return;
+    }
+    if (!column.hasRange || value < column.minFloat) column.minFloat = value;
+    if (!column.hasRange || value > column.maxFloat) column.maxFloat = value;
+    column.hasRange = true;
+}
+
+void ColumnarWriter::putDictionary(Column &column, const char *value) {
+    std::string key(value ? value : "");
+    auto found = column.codes.find(key);
+    uint32_t code;
+    if (found == column.codes.end())
+    {
+        code = (uint32_t)column.dictionary.size();
+        column.codes[key] = code;
+        column.dictionary.push_back(key);
+    }
+    else
+    {
+        code = found->second;
+    }
+    appendValue(column.data, code);
+}
+
+void ColumnarWriter::putString(Column &column, const char *value) {
+    if (column.offsets.empty()) column.offsets.push_back(0);
+    size_t length = value ? strlen(value) : 0;
+    column.data.insert(column.data.end(), value, value + length);
+    column.offsets.push_back((uint32_t)column.data.size());
+}
+
+void ColumnarWriter::append(const ColumnarRow &row) {
+    putString(columns[COL_FILE_NAME], row.fileName);
+    putInt(columns[COL_TIME_TAKEN], row.timeTaken, row.timeTaken == kUnknownTime);
+    putFloat(columns[COL_LATITUDE], row.latitude);
+    putFloat(columns[COL_LONGITUDE], row.longitude);
+    putFloat(columns[COL_ALTITUDE], row.altitude);
+    putUnsigned(columns[COL_FILE_SIZE], row.fileSize, 8);
+    putUnsigned(columns[COL_WIDTH], row.width, 4);
+    putUnsigned(columns[COL_HEIGHT], row.height, 4);
+    putUnsigned(columns[COL_ISO], row.iso, 2);
+    putUnsigned(columns[COL_ORIENTATION], row.orientation, 2);
+    putFloat(columns[COL_FNUMBER], row.fNumber);
+    putFloat(columns[COL_EXPOSURE_TIME], row.exposureTime);
+    putDictionary(columns[COL_SOFTWARE], row.software);
+    putDictionary(columns[COL_MAKE], row.make);
+    putDictionary(columns[COL_MODEL], row.model);
+
+    if (++rows == rowsPerGroup) flushRowGroup();
+}
+
+void ColumnarWriter::writeBytes(const void *bytes, size_t length) {
+    if (length == 0) return;
+    if (fp && fwrite(bytes, 1, length, fp) != length) failed = true;
+    position += length;
+}
+
+void ColumnarWriter::pad() {
+    static const char zeros[8] = { 0 };
+    size_t padding = (size_t)((8 - position % 8) % 8);
+    writeBytes(zeros, padding);
+}
+
+void ColumnarWriter::flushRowGroup() {
+    if (rows == 0) return;
+
+    std::vector<ChunkInfo> chunks;
+    for (size_t i = 0; i < columns.size(); i++) {
+        Column &column = columns[i];
+        pad();
+
+        ChunkInfo chunk;
+        memset(&chunk, 0, sizeof(chunk));
+        chunk.offset = position;
+        if (column.type == COLUMN_STRING)
+        {
+            writeBytes(column.offsets.data(), column.offsets.size() * sizeof(uint32_t));
+        }
+        writeBytes(column.data.data(), column.data.size());
+        chunk.length = position - chunk.offset;
+        chunk.nulls = column.nulls;
+
+        if (column.hasRange && column.type == COLUMN_FLOAT64)
+        {
+            memcpy(chunk.min, &column.minFloat, 8);
+            memcpy(chunk.max, &column.maxFloat, 8);
+        }
+        else if (column.hasRange)
+        {
+            memcpy(chunk.min, &column.minInt, 8);
+            memcpy(chunk.max, &column.maxInt, 8);
+        }
+        chunks.push_back(chunk);
+
+        column.data.clear();
+        column.offsets.clear();
+        column.nulls = 0;
+        column.hasRange = false;
+    }
+    rowGroups.push_back(std::make_pair((uint64_t)rows, chunks));
+    rows = 0;
+}
+
+int ColumnarWriter::close() {
+    if (!fp) return 0;
+    flushRowGroup();
+    pad();
+
+    std::vector<char> footer;
+    appendValue(footer, kColumnarVersion);
+    appendValue(footer, (uint32_t)columns.size());
+    for (size_t i = 0; i < columns.size(); i++) {
+        uint8_t nameLength = (uint8_t)strlen(columns[i].name);
+        appendValue(footer, (uint8_t)columns[i].type);
+        appendValue(footer, nameLength);
+        footer.insert(footer.end(), columns[i].name, columns[i].name + nameLength);
+    }
+
+    appendValue(footer, (uint32_t)rowGroups.size());
+    for (size_t g = 0; g < rowGroups.size(); g++) {
+        appendValue(footer, rowGroups[g].first);
+        const std::vector<ChunkInfo> &chunks = rowGroups[g].second;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            appendValue(footer, chunks[i].offset);
+            appendValue(footer, chunks[i].length);
+            appendValue(footer, chunks[i].nulls);
+            footer.insert(footer.end(), chunks[i].min, chunks[i].min + 8);
+            footer.insert(footer.end(), chunks[i].max, chunks[i].max + 8);
+        }
+    }
+
+    uint32_t dictionaries = 0;
+    for (size_t i = 0; i < columns.size(); i++) {
+        if (columns[i].type == COLUMN_DICTIONARY) dictionaries++;
+    }
+    appendValue(footer, dictionaries);
+    for (size_t i = 0; i < columns.size(); i++) {
+        if (columns[i].type != COLUMN_DICTIONARY) continue;
+        const std::vector<std::string> &entries = columns[i].dictionary;
+        appendValue(footer, (uint32_t)entries.size());
+        for (size_t e = 0; e < entries.size(); e++) {
+            appendValue(footer, (uint32_t)entries[e].size());
+            footer.insert(footer.end(), entries[e].begin(), entries[e].end());
+        }
+    }
+
+    uint64_t footerOffset = position;
+    writeBytes(footer.data(), footer.size());
+    writeBytes(&footerOffset, sizeof(footerOffset));
+    writeBytes(kColumnarMagic, sizeof(kColumnarMagic));
+
+    if (fclose(fp) != 0) failed = true;
+    fp = nullptr;
+    return failed ? -1 : 0;
+}
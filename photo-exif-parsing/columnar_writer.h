@@ -0,0 +1,136 @@
+//
+//  columnar_writer.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__columnar_writer__
+#define __photo_exif_parsing__columnar_writer__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "exif_time.h"
+
+// Binary column store for the photo table, meant to be mmap'ed and scanned
+// one column at a time by downstream jobs instead of re-parsing CSV.
+//
+// Layout (all integers little-endian, every chunk 8-byte aligned):
+//
+//   "PHOTOCOL"                                         8-byte magic
+//   row group 0: one chunk per column, in column order
+//   row group 1: ...
+//   footer
+//   u64 footer offset, "PHOTOCOL"                      16-byte trailer
+//
+// Fixed-width columns are plain arrays of their type. Dictionary columns
+// are arrays of u32 codes into a file-wide dictionary stored in the footer.
+// The string column is u32 offsets[rows + 1] followed by the bytes.
+//
+// Footer:
+//   u32 version, u32 column count
+//   per column: u8 type, u8 name length, name bytes
+//   u32 row group count
+//   per row group: u64 rows, then per column:
+//       u64 offset, u64 length, u64 null count, 8-byte min, 8-byte max
+//     (min/max are int64 for integer columns, double for FLOAT64 and zero
+//      for string and dictionary columns; nulls are NaN doubles and
+//      kUnknownTime timestamps and are left out of min/max)
+//   u32 dictionary count, per dictionary: u32 entries, each u32 length + bytes
+//     (dictionaries appear in the order their columns do)
+enum ColumnType
+{
+    COLUMN_INT64 = 1,
+    COLUMN_UINT64 = 2,
+    COLUMN_UINT32 = 3,
+    COLUMN_UINT16 = 4,
+    COLUMN_FLOAT64 = 5,
+    COLUMN_DICTIONARY = 6,
+    COLUMN_STRING = 7
+};
+
+// One photo as it goes into the column store.
+struct ColumnarRow
+{
+    const char *fileName;
+    int64_t timeTaken;      // nanoseconds since the epoch, or kUnknownTime
+    double latitude;
+    double longitude;
+    double altitude;
+    uint64_t fileSize;
+    uint32_t width;
+    uint32_t height;
+    uint16_t iso;
+    uint16_t orientation;
+    double fNumber;
+    double exposureTime;
+    const char *software;
+    const char *make;
+    const char *model;
+};
+
+class ColumnarWriter
+{
+public:
+    explicit ColumnarWriter(size_t rowsPerGroup = 65536);
+    ~ColumnarWriter();
+
+    // Returns 0 or -1 if fileName can't be created.
+    int open(const char *fileName);
+    void append(const ColumnarRow &row);
+    // Writes the last row group and the footer. Returns 0 or -1 if any
+    // write failed.
+    int close();
+
+private:
+    struct Column
+    {
+        const char *name;
+        ColumnType type;
+        std::vector<char> data;
+        std::vector<uint32_t> offsets;      // COLUMN_STRING only
+        uint64_t nulls;
+        bool hasRange;
+        int64_t minInt, maxInt;
+        double minFloat, maxFloat;
+
+        // COLUMN_DICTIONARY only
+        std::unordered_map<std::string, uint32_t> codes;
+        std::vector<std::string> dictionary;
+    };
+
+    struct ChunkInfo
+    {
+        uint64_t offset;
+        uint64_t length;
+        uint64_t nulls;
+        char min[8];
+        char max[8];
+    };
+
+    void addColumn(const char *name, ColumnType type);
+    void putInt(Column &column, int64_t value, bool isNull);
+    void putUnsigned(Column &column, uint64_t value, size_t width);
+    void putFloat(Column &column, double value);
+    void putDictionary(Column &column, const char *value);
+    void putString(Column &column, const char *value);
+    void writeBytes(const void *bytes, size_t length);
+    void pad();
+    void flushRowGroup();
+
+    FILE *fp;
+    uint64_t position;
+    bool failed;
+    size_t rowsPerGroup;
+    size_t rows;
+    std::vector<Column> columns;
+    std::vector<std::pair<uint64_t, std::vector<ChunkInfo> > > rowGroups;
+
+    ColumnarWriter(const ColumnarWriter &);
+    ColumnarWriter &operator=(const ColumnarWriter &);
+};
+
+#endif /* defined(__photo_exif_parsing__columnar_writer__) */
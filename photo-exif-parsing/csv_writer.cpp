@@ -0,0 +1,141 @@
+//
+//  csv_writer.cpp
+//  photo-exif-parsing
+//
+
+#include "csv_writer.h"
+
+#include <algorithm>
+#include <string.h>
+
+size_t formatDouble(char *out, double value) {
+    int written = snprintf(out, 32, "%g", value);
+    return written > 0 ? (size_t)written : 0;
+}
+
+CSVWriter::CSVWriter(size_t bufferSize)
+: fp(nullptr), buffer(bufferSize < 4096 ? 4096 : bufferSize), used(0), rowStarted(false), failed(false)
+{
+}
+
+CSVWriter::~CSVWriter() {
+    close();
+}
+
+int CSVWriter::open(const char *fileName) {
+    close();
+    fp = fopen(fileName, "wb");
+    if (!fp) return -1;
+    // The stdio buffer would only add a second copy in front of ours.
+    setvbuf(fp, nullptr, _IONBF, 0);
+    failed = false;
+    return 0;
+}
+
+int CSVWriter::close() {
+    if (!fp) return 0;
+    flush();
+    if (fclose(fp) != 0) failed = true;
+    fp = nullptr;
+    return failed ? -1 : 0;
+}
+
+void CSVWriter::flush() {
+    // Without a file the buffer is the only copy of the rows; keep them
+    // for takeRows.
+    if (!fp) return;
+    if (used > 0 && fwrite(&buffer[0], 1, used, fp) != used) failed = true;
+    used = 0;
+}
+
+void CSVWriter::takeRows(std::vector<char> &out) {
+    out.assign(buffer.begin(), buffer.begin() + used);
+    used = 0;
+}
+
+void CSVWriter::appendRows(const std::vector<char> &rows) {
+    if (!rows.empty()) append(&rows[0], rows.size());
+}
+
+void CSVWriter::append(const char *bytes, size_t length) {
+    if (used + length > buffer.size() && !fp)
+    {
+        buffer.resize(std::max(buffer.size() * 2, used + length));
+    }
+    else if (used + length > buffer.size())
+    {
+        flush();
+        if (length > buffer.size())
+        {
+            if (fp && fwrite(bytes, 1, length, fp) != length) failed = true;
+            return;
+        }
+    }
+    memcpy(&buffer[used], bytes, length);
+    used += length;
+}
+
+void CSVWriter::separate() {
+    if (rowStarted) append(",", 1);
+    rowStarted = true;
+}
+
+void CSVWriter::field(const char *value) {
+    separate();
+    size_t length = strlen(value);
+    if (strpbrk(value, ",\"\r\n") == nullptr)
+    {
+        append(value, length);
+        return;
+    }
+
+    append("\"", 1);
+    const char *start = value;
+    for (const char *quote = strchr(start, '"'); quote; quote = strchr(start, '"')) {
+        append(start, quote - start + 1);
+        append("\"", 1);
+        start = quote + 1;
+    }
+    append(start, strlen(start));
+    append("\"", 1);
+}
+
+void CSVWriter::field(uint64_t value) {
+    separate();
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - 1 - count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    append(digits + sizeof(digits) - count, count);
+}
+
+void CSVWriter::field(int64_t value) {
+    if (value >= 0)
+    {
+        field((uint64_t)value);
+        return;
+    }
+    separate();
+    append("-", 1);
+    // Format the magnitude without a second separator.
+    rowStarted = false;
+    field((uint64_t)0 - (uint64_t)value);
+}
+
+void CSVWriter::field(double value) {
+    separate();
+    char text[32];
+    append(text, formatDouble(text, value));
+}
+
+void CSVWriter::rawField(const char *value) {
+    separate();
+    append(value, strlen(value));
+}
+
+void CSVWriter::endRow() {
+    append("\n", 1);
+    rowStarted = false;
+}
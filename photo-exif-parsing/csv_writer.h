@@ -0,0 +1,77 @@
+//
+//  csv_writer.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__csv_writer__
+#define __photo_exif_parsing__csv_writer__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Buffered CSV output. Rows are formatted into a large user-space buffer
+// without locale lookups and written out in whole chunks; nothing is flushed
+// per row. String fields are quoted per RFC 4180 only when they contain a
+// comma, quote or line break, so ordinary rows come out exactly as before.
+//
+// Not thread-safe; callers serialize rows themselves.
+class CSVWriter
+{
+public:
+    explicit CSVWriter(size_t bufferSize = 1 << 20);
+    ~CSVWriter();
+
+    // Returns 0 or -1 if fileName can't be created.
+    int open(const char *fileName);
+    // Flushes and closes. Returns 0 or -1 if any write failed.
+    int close();
+    bool isOpen() const { return fp != nullptr; }
+
+    void field(const char *value);
+    void field(const std::string &value) { field(value.c_str()); }
+    void field(uint64_t value);
+    void field(int64_t value);
+    void field(unsigned value) { field((uint64_t)value); }
+    void field(int value) { field((int64_t)value); }
+    // Formats like operator<< on a default ostream ("%g"), so the columns
+    // keep the precision they always had.
+    void field(double value);
+    // Written verbatim, e.g. a literal such as "0" or a pre-formatted value.
+    void rawField(const char *value);
+
+    void endRow();
+
+    // Hands everything buffered so far to the OS; a no-op until opened.
+    void flush();
+
+    // For formatting on one thread and writing on another: an unopened
+    // writer collects rows until takeRows moves them into out, and the
+    // open one appends them verbatim. An unopened writer grows its buffer
+    // rather than drop rows; take them once buffered() passes the size
+    // you want to hand over at a time.
+    size_t buffered() const { return used; }
+    void takeRows(std::vector<char> &out);
+    void appendRows(const std::vector<char> &rows);
+
+private:
+    void separate();
+    void append(const char *bytes, size_t length);
+
+    FILE *fp;
+    std::vector<char> buffer;
+    size_t used;
+    bool rowStarted;
+    bool failed;
+
+    CSVWriter(const CSVWriter &);
+    CSVWriter &operator=(const CSVWriter &);
+};
+
+// Formats value the way a default std::ostream would and returns the
+// number of characters written to out (which must hold 32 bytes).
+size_t formatDouble(char *out, double value);
+
+#endif /* defined(__photo_exif_parsing__csv_writer__) */
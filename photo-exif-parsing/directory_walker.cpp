@@ -0,0 +1,179 @@
+//
+//  directory_walker.cpp
+//  photo-exif-parsing
+//
+
+#include "directory_walker.h"
+
+#include <fnmatch.h>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+using namespace boost::filesystem;
+
+namespace {
+    struct PendingDirectory
+    {
+        path directory;
+        std::string relative;
+        int depth;
+    };
+
+    std::string lowercase(std::string text) {
+        for (size_t i = 0; i < text.size(); i++) {
+            if (text[i] >= 'A' && text[i] <= 'Z') text[i] = text[i] - 'A' + 'a';
+        }
+        return text;
+    }
+
+    bool matchesAny(const std::vector<std::string> &globs, const std::string &relative) {
+        for (size_t i = 0; i < globs.size(); i++) {
+            if (fnmatch(globs[i].c_str(), relative.c_str(), FNM_CASEFOLD) == 0) return true;
+        }
+        return false;
+    }
+
+    class Walker
+    {
+    public:
+        Walker(const WalkOptions &options, const WalkSink &sink)
+        : options(options), sink(sink), busy(0), emitted(0)
+        {
+            for (size_t i = 0; i < options.extensions.size(); i++) {
+                extensions.push_back(lowercase(options.extensions[i]));
+            }
+        }
+
+        size_t run(const std::string &root) {
+            PendingDirectory start = { path(root), std::string(), 0 };
+            pending.push_back(start);
+
+            unsigned threadCount = options.threads ? options.threads : std::thread::hardware_concurrency();
+            if (threadCount == 0) threadCount = 1;
+
+            std::vector<std::thread> threads;
+            for (unsigned i = 0; i < threadCount; i++) {
+                threads.push_back(std::thread(&Walker::work, this));
+            }
+            for (size_t i = 0; i < threads.size(); i++) {
+                threads[i].join();
+            }
+            return emitted.load();
+        }
+
+    private:
+        bool acceptsFile(const path &file, const std::string &relative) const {
+            if (!extensions.empty())
+            {
+                std::string extension = lowercase(file.extension().string());
+                bool matched = false;
+                for (size_t i = 0; i < extensions.size() && !matched; i++) {
+                    matched = extension == extensions[i];
+                }
+                if (!matched) return false;
+            }
+            if (!options.includeGlobs.empty() && !matchesAny(options.includeGlobs, relative)) return false;
+            return !matchesAny(options.excludeGlobs, relative);
+        }
+
+        // Unreadable entries are reported and skipped rather than thrown, so
+        // one bad entry costs neither its siblings nor the subdirectories
+        // already found. A failed listing stops at that point.
+        void list(const PendingDirectory &current) {
+            std::vector<PendingDirectory> subdirectories;
+            boost::system::error_code error;
+            directory_iterator it(current.directory, error);
+            for (; !error && it != directory_iterator(); it.increment(error)) {
+                const directory_entry &entry = *it;
+                std::string name = entry.path().filename().string();
+                std::string relative = current.relative.empty() ? name : current.relative + "/" + name;
+
+                boost::system::error_code statusError;
+                file_status status = options.followSymlinks ? entry.status(statusError) : entry.symlink_status(statusError);
+                if (statusError)
+                {
+                    std::cerr << entry.path().string() << ": " << statusError.message() << '\n';
+                    continue;
+                }
+                if (is_directory(status))
+                {
+                    if (options.maxDepth >= 0 && current.depth >= options.maxDepth) continue;
+                    if (matchesAny(options.excludeGlobs, relative)) continue;
+                    PendingDirectory child = { entry.path(), relative, current.depth + 1 };
+                    subdirectories.push_back(child);
+                }
+                else if (is_regular_file(status) && acceptsFile(entry.path(), relative))
+                {
+                    emitted.fetch_add(1, std::memory_order_relaxed);
+                    sink(entry.path().string());
+                }
+            }
+            if (error) std::cerr << current.directory.string() << ": " << error.message() << '\n';
+
+            if (subdirectories.empty()) return;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                for (size_t i = 0; i < subdirectories.size(); i++) {
+                    pending.push_back(std::move(subdirectories[i]));
+                }
+            }
+            wake.notify_all();
+        }
+
+        void work() {
+            for (;;) {
+                PendingDirectory current;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    // Done once nothing is queued and nobody is still listing
+                    // a directory that could queue more.
+                    wake.wait(guard, [this] { return !pending.empty() || busy == 0; });
+                    if (pending.empty()) return;
+                    current = std::move(pending.back());
+                    pending.pop_back();
+                    busy++;
+                }
+
+                try
+                {
+                    list(current);
+                }
+                catch (filesystem_error &e)
+                {
+                    std::cerr << e.what() << '\n';
+                }
+
+                bool finished;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    busy--;
+                    finished = busy == 0 && pending.empty();
+                }
+                if (finished) wake.notify_all();
+            }
+        }
+
+        const WalkOptions &options;
+        const WalkSink &sink;
+        std::vector<std::string> extensions;
+
+        std::mutex lock;
+        std::condition_variable wake;
+        // Depth-first: popping the newest directory keeps the queue short on
+        // deep year/month trees.
+        std::vector<PendingDirectory> pending;
+        unsigned busy;
+        std::atomic<size_t> emitted;
+    };
+}
+
+size_t walkDirectory(const std::string &root, const WalkOptions &options, const WalkSink &sink) {
+    Walker walker(options, sink);
+    return walker.run(root);
+}
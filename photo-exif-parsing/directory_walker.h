@@ -0,0 +1,51 @@
+//
+//  directory_walker.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__directory_walker__
+#define __photo_exif_parsing__directory_walker__
+
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct WalkOptions
+{
+    // How many levels below the root to descend; -1 means no limit and 0
+    // lists only the root itself.
+    int maxDepth;
+
+    // File extensions to accept, compared case-insensitively and including
+    // the dot (".jpg"). Empty accepts every file.
+    std::vector<std::string> extensions;
+
+    // fnmatch(3) patterns tested case-insensitively against the path
+    // relative to the root, where '*' also matches '/'. A file must match
+    // one include pattern when any are given; files and directories that
+    // match an exclude pattern are skipped.
+    std::vector<std::string> includeGlobs;
+    std::vector<std::string> excludeGlobs;
+
+    // Threads listing directories; 0 picks hardware_concurrency().
+    unsigned threads;
+
+    // Descend into symlinked directories. Off by default so link cycles
+    // can't make the walk run forever.
+    bool followSymlinks;
+
+    WalkOptions() : maxDepth(-1), threads(0), followSymlinks(false) {}
+};
+
+// Called for every accepted file as soon as its directory has been listed.
+// It runs concurrently on the walker threads, so it has to be thread-safe.
+typedef std::function<void(const std::string &fileName)> WalkSink;
+
+// Walks root recursively, listing subdirectories in parallel and streaming
+// accepted files into sink without ever holding the whole listing. Errors
+// listing a directory are reported on stderr and the walk carries on.
+// Returns the number of files handed to sink.
+size_t walkDirectory(const std::string &root, const WalkOptions &options, const WalkSink &sink);
+
+#endif /* defined(__photo_exif_parsing__directory_walker__) */
@@ -0,0 +1,380 @@
+//
+//  exif_decoder.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__exif_decoder__
+#define __photo_exif_parsing__exif_decoder__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "jpeg_markers.h"
+
+// Groups of EXIF fields a caller can ask ExifRecord/decodeExif for. Fields
+// outside the set are neither stored nor decoded: their IFD entries are
+// stepped over without reading the value, and sub-IFDs holding none of
+// them are never visited.
+enum ExifFieldSet
+{
+    EXIF_TIME       = 1 << 0,   // DateTimeOriginal, SubSecTimeOriginal, OffsetTimeOriginal
+    EXIF_LOCATION   = 1 << 1,   // GPS latitude, longitude, altitude
+    EXIF_IMAGE      = 1 << 2,   // PixelX/YDimension, Orientation
+    EXIF_EXPOSURE   = 1 << 3,   // ExposureTime, FNumber, ISOSpeedRatings
+    EXIF_CAMERA     = 1 << 4,   // Make, Model, Software
+    EXIF_THUMBNAIL  = 1 << 5    // IFD1 JPEGInterchangeFormat and its length
+};
+
+// Times are kept in fixed arrays, NUL-terminated and empty when missing,
+// so decoding them never allocates.
+struct ExifTimeGroup
+{
+    char dateTimeOriginal[20];
+    char subSecTimeOriginal[10];
+    char offsetTimeOriginal[8];
+
+    ExifTimeGroup() { dateTimeOriginal[0] = subSecTimeOriginal[0] = offsetTimeOriginal[0] = '\0'; }
+};
+
+// Degrees, negative south and west as in EXIFInfo; meters, negative below
+// sea level.
+struct ExifLocationGroup
+{
+    bool hasLocation;
+    double latitude;
+    double longitude;
+    double altitude;
+
+    ExifLocationGroup() : hasLocation(false), latitude(0), longitude(0), altitude(0) {}
+};
+
+struct ExifImageGroup
+{
+    uint32_t width;
+    uint32_t height;
+    uint16_t orientation;
+
+    ExifImageGroup() : width(0), height(0), orientation(0) {}
+};
+
+struct ExifExposureGroup
+{
+    double exposureTime;    // seconds
+    double fNumber;
+    uint16_t iso;
+
+    ExifExposureGroup() : exposureTime(0), fNumber(0), iso(0) {}
+};
+
+struct ExifCameraGroup
+{
+    std::string make;
+    std::string model;
+    std::string software;
+};
+
+// Where the embedded JPEG thumbnail lies, as a span of the bytes handed to
+// the decoder; thumbnailLength is 0 when there is none or it doesn't fit.
+struct ExifThumbnailGroup
+{
+    uint64_t thumbnailOffset;
+    uint32_t thumbnailLength;
+
+    ExifThumbnailGroup() : thumbnailOffset(0), thumbnailLength(0) {}
+};
+
+// Stand-in for a group that wasn't asked for; distinct per group so a
+// record can derive from several.
+template <int Group> struct ExifNoGroup {};
+
+// The decoded fields of one image, with members only for the groups in
+// Fields: ExifRecord<EXIF_TIME | EXIF_LOCATION> is a time and a position
+// and nothing else.
+template <unsigned Fields>
+struct ExifRecord
+: std::conditional<(Fields & EXIF_TIME) != 0, ExifTimeGroup, ExifNoGroup<0> >::type,
+  std::conditional<(Fields & EXIF_LOCATION) != 0, ExifLocationGroup, ExifNoGroup<1> >::type,
+  std::conditional<(Fields & EXIF_IMAGE) != 0, ExifImageGroup, ExifNoGroup<2> >::type,
+  std::conditional<(Fields & EXIF_EXPOSURE) != 0, ExifExposureGroup, ExifNoGroup<3> >::type,
+  std::conditional<(Fields & EXIF_CAMERA) != 0, ExifCameraGroup, ExifNoGroup<4> >::type,
+  std::conditional<(Fields & EXIF_THUMBNAIL) != 0, ExifThumbnailGroup, ExifNoGroup<5> >::type
+{
+    typedef typename std::conditional<(Fields & EXIF_TIME) != 0, ExifTimeGroup, ExifNoGroup<0> >::type TimeBase;
+    typedef typename std::conditional<(Fields & EXIF_LOCATION) != 0, ExifLocationGroup, ExifNoGroup<1> >::type LocationBase;
+    typedef typename std::conditional<(Fields & EXIF_IMAGE) != 0, ExifImageGroup, ExifNoGroup<2> >::type ImageBase;
+    typedef typename std::conditional<(Fields & EXIF_EXPOSURE) != 0, ExifExposureGroup, ExifNoGroup<3> >::type ExposureBase;
+    typedef typename std::conditional<(Fields & EXIF_CAMERA) != 0, ExifCameraGroup, ExifNoGroup<4> >::type CameraBase;
+    typedef typename std::conditional<(Fields & EXIF_THUMBNAIL) != 0, ExifThumbnailGroup, ExifNoGroup<5> >::type ThumbnailBase;
+};
+
+namespace exif_decoder_detail {
+    enum
+    {
+        TIFF_BYTE = 1, TIFF_ASCII = 2, TIFF_SHORT = 3, TIFF_LONG = 4, TIFF_RATIONAL = 5,
+        TIFF_UNDEFINED = 7, TIFF_SLONG = 9, TIFF_SRATIONAL = 10
+    };
+
+    // Bounds-checked reads from a TIFF block in either byte order. Offsets
+    // are relative to the "II"/"MM" header, as in the IFDs.
+    class TiffBlock
+    {
+    public:
+        TiffBlock(const unsigned char *bytes, size_t length)
+        : bytes(bytes), length(length), bigEndian(false) {}
+
+        // Reads the byte order and returns the IFD0 offset, or 0.
+        uint32_t open() {
+            if (length < 8) return 0;
+            if (bytes[0] == 'I' && bytes[1] == 'I') bigEndian = false;
+            else if (bytes[0] == 'M' && bytes[1] == 'M') bigEndian = true;
+            else return 0;
+            if (u16(2) != 42) return 0;
+            return u32(4);
+        }
+
+        bool has(size_t at, size_t count) const { return at <= length && count <= length - at; }
+
+        uint16_t u16(size_t at) const {
+            return bigEndian ? (uint16_t)(bytes[at] << 8 | bytes[at + 1])
+                             : (uint16_t)(bytes[at + 1] << 8 | bytes[at]);
+        }
+
+        uint32_t u32(size_t at) const {
+            return bigEndian ? (uint32_t)bytes[at] << 24 | (uint32_t)bytes[at + 1] << 16 | (uint32_t)bytes[at + 2] << 8 | bytes[at + 3]
+                             : (uint32_t)bytes[at + 3] << 24 | (uint32_t)bytes[at + 2] << 16 | (uint32_t)bytes[at + 1] << 8 | bytes[at];
+        }
+
+        const unsigned char *at(size_t offset) const { return bytes + offset; }
+
+    private:
+        const unsigned char *bytes;
+        size_t length;
+        bool bigEndian;
+    };
+
+    // One IFD entry; value is where its data starts, inline or not.
+    struct Entry
+    {
+        uint16_t tag;
+        uint16_t type;
+        uint32_t count;
+        size_t value;
+    };
+
+    inline size_t typeSize(uint16_t type) {
+        switch (type) {
+            case TIFF_BYTE: case TIFF_ASCII: case TIFF_UNDEFINED: return 1;
+            case TIFF_SHORT: return 2;
+            case TIFF_LONG: case TIFF_SLONG: return 4;
+            case TIFF_RATIONAL: case TIFF_SRATIONAL: return 8;
+            default: return 0;
+        }
+    }
+
+    // Calls visit for every entry of the IFD at offset whose data lies
+    // inside the block. Returns false when the IFD itself doesn't.
+    template <typename Visit>
+    bool forEachEntry(const TiffBlock &tiff, uint32_t offset, Visit visit) {
+        if (!offset || !tiff.has(offset, 2)) return false;
+        unsigned count = tiff.u16(offset);
+        if (!tiff.has(offset + 2, (size_t)count * 12)) return false;
+        for (unsigned i = 0; i < count; i++) {
+            size_t at = offset + 2 + (size_t)i * 12;
+            Entry entry;
+            entry.tag = tiff.u16(at);
+            entry.type = tiff.u16(at + 2);
+            entry.count = tiff.u32(at + 4);
+            size_t size = typeSize(entry.type) * entry.count;
+            entry.value = size <= 4 ? at + 8 : tiff.u32(at + 8);
+            if (!size || !tiff.has(entry.value, size)) continue;
+            visit(entry);
+        }
+        return true;
+    }
+
+    inline unsigned readUnsigned(const TiffBlock &tiff, const Entry &entry) {
+        if (entry.type == TIFF_SHORT) return tiff.u16(entry.value);
+        if (entry.type == TIFF_LONG) return tiff.u32(entry.value);
+        if (entry.type == TIFF_BYTE) return *tiff.at(entry.value);
+        return 0;
+    }
+
+    inline double readRational(const TiffBlock &tiff, const Entry &entry, unsigned index) {
+        if ((entry.type != TIFF_RATIONAL && entry.type != TIFF_SRATIONAL) || index >= entry.count) return 0;
+        size_t at = entry.value + (size_t)index * 8;
+        uint32_t denominator = tiff.u32(at + 4);
+        if (!denominator) return 0;
+        if (entry.type == TIFF_SRATIONAL) return (double)(int32_t)tiff.u32(at) / (int32_t)denominator;
+        return (double)tiff.u32(at) / denominator;
+    }
+
+    // Copies an ASCII value up to its NUL into out[capacity].
+    inline void readAscii(const TiffBlock &tiff, const Entry &entry, char *out, size_t capacity) {
+        size_t length = 0;
+        if (entry.type == TIFF_ASCII)
+        {
+            const char *text = (const char *)tiff.at(entry.value);
+            while (length < entry.count && length + 1 < capacity && text[length]) length++;
+            memcpy(out, text, length);
+        }
+        out[length] = '\0';
+    }
+
+    inline void readAscii(const TiffBlock &tiff, const Entry &entry, std::string &out) {
+        if (entry.type != TIFF_ASCII) return;
+        const char *text = (const char *)tiff.at(entry.value);
+        out.assign(text, strnlen(text, entry.count));
+    }
+
+    // One handler per field group; the ExifNoGroup overloads do nothing
+    // and vanish once inlined.
+    inline void readTimeTag(ExifTimeGroup &fields, const TiffBlock &tiff, const Entry &entry) {
+        switch (entry.tag) {
+            case 0x9003: readAscii(tiff, entry, fields.dateTimeOriginal, sizeof(fields.dateTimeOriginal)); break;
+            case 0x9291: readAscii(tiff, entry, fields.subSecTimeOriginal, sizeof(fields.subSecTimeOriginal)); break;
+            case 0x9011: readAscii(tiff, entry, fields.offsetTimeOriginal, sizeof(fields.offsetTimeOriginal)); break;
+        }
+    }
+    inline void readTimeTag(ExifNoGroup<0> &, const TiffBlock &, const Entry &) {}
+
+    inline void readImageTag(ExifImageGroup &fields, const TiffBlock &tiff, const Entry &entry) {
+        switch (entry.tag) {
+            case 0xA002: fields.width = readUnsigned(tiff, entry); break;
+            case 0xA003: fields.height = readUnsigned(tiff, entry); break;
+            case 0x0112: fields.orientation = (uint16_t)readUnsigned(tiff, entry); break;
+        }
+    }
+    inline void readImageTag(ExifNoGroup<2> &, const TiffBlock &, const Entry &) {}
+
+    inline void readExposureTag(ExifExposureGroup &fields, const TiffBlock &tiff, const Entry &entry) {
+        switch (entry.tag) {
+            case 0x829A: fields.exposureTime = readRational(tiff, entry, 0); break;
+            case 0x829D: fields.fNumber = readRational(tiff, entry, 0); break;
+            case 0x8827: fields.iso = (uint16_t)readUnsigned(tiff, entry); break;
+        }
+    }
+    inline void readExposureTag(ExifNoGroup<3> &, const TiffBlock &, const Entry &) {}
+
+    inline void readCameraTag(ExifCameraGroup &fields, const TiffBlock &tiff, const Entry &entry) {
+        switch (entry.tag) {
+            case 0x010F: readAscii(tiff, entry, fields.make); break;
+            case 0x0110: readAscii(tiff, entry, fields.model); break;
+            case 0x0131: readAscii(tiff, entry, fields.software); break;
+        }
+    }
+    inline void readCameraTag(ExifNoGroup<4> &, const TiffBlock &, const Entry &) {}
+
+    inline void readLocation(ExifLocationGroup &fields, const TiffBlock &tiff, uint32_t gpsOffset) {
+        char latitudeRef = 0, longitudeRef = 0;
+        bool haveLatitude = false, haveLongitude = false, belowSeaLevel = false;
+        forEachEntry(tiff, gpsOffset, [&](const Entry &entry) {
+            switch (entry.tag) {
+                case 0x0001: if (entry.count) latitudeRef = (char)*tiff.at(entry.value); break;
+                case 0x0003: if (entry.count) longitudeRef = (char)*tiff.at(entry.value); break;
+                case 0x0002:
+                    fields.latitude = readRational(tiff, entry, 0) + readRational(tiff, entry, 1) / 60 +
+                                      readRational(tiff, entry, 2) / 3600;
+                    haveLatitude = entry.count >= 3;
+                    break;
+                case 0x0004:
+                    fields.longitude = readRational(tiff, entry, 0) + readRational(tiff, entry, 1) / 60 +
+                                       readRational(tiff, entry, 2) / 3600;
+                    haveLongitude = entry.count >= 3;
+                    break;
+                case 0x0005: belowSeaLevel = entry.count && *tiff.at(entry.value) == 1; break;
+                case 0x0006: fields.altitude = readRational(tiff, entry, 0); break;
+            }
+        });
+        if (latitudeRef == 'S') fields.latitude = -fields.latitude;
+        if (longitudeRef == 'W') fields.longitude = -fields.longitude;
+        if (belowSeaLevel) fields.altitude = -fields.altitude;
+        fields.hasLocation = haveLatitude && haveLongitude;
+    }
+    inline void readLocation(ExifNoGroup<1> &, const TiffBlock &, uint32_t) {}
+
+    // IFD1 follows IFD0's entries; its offset is the link after them.
+    inline uint32_t nextIfd(const TiffBlock &tiff, uint32_t offset) {
+        if (!tiff.has(offset, 2)) return 0;
+        size_t link = offset + 2 + (size_t)tiff.u16(offset) * 12;
+        return tiff.has(link, 4) ? tiff.u32(link) : 0;
+    }
+
+    inline void readThumbnail(ExifThumbnailGroup &fields, const TiffBlock &tiff, uint32_t ifd1) {
+        uint32_t start = 0, length = 0;
+        forEachEntry(tiff, ifd1, [&](const Entry &entry) {
+            if (entry.tag == 0x0201) start = readUnsigned(tiff, entry);
+            else if (entry.tag == 0x0202) length = readUnsigned(tiff, entry);
+        });
+        if (!start || length < 4 || !tiff.has(start, length)) return;
+        if (tiff.at(start)[0] != 0xFF || tiff.at(start)[1] != 0xD8) return;
+        fields.thumbnailOffset = start;
+        fields.thumbnailLength = length;
+    }
+    inline void readThumbnail(ExifNoGroup<5> &, const TiffBlock &, uint32_t) {}
+
+    inline void moveThumbnail(ExifThumbnailGroup &fields, uint64_t by) {
+        if (fields.thumbnailLength) fields.thumbnailOffset += by;
+    }
+    inline void moveThumbnail(ExifNoGroup<5> &, uint64_t) {}
+}
+
+// Decodes the requested fields from a TIFF block (what follows
+// "Exif\0\0" in APP1, starting at the byte order mark). Returns 0, or -3
+// if the block has no valid IFD0.
+template <unsigned Fields>
+int decodeExifSegment(const unsigned char *tiffBytes, size_t length, ExifRecord<Fields> &out) {
+    using namespace exif_decoder_detail;
+    typedef ExifRecord<Fields> Record;
+    const bool wantExifIfd = (Fields & (EXIF_TIME | EXIF_IMAGE | EXIF_EXPOSURE)) != 0;
+    const bool wantGps = (Fields & EXIF_LOCATION) != 0;
+
+    TiffBlock tiff(tiffBytes, length);
+    uint32_t ifd0 = tiff.open();
+    uint32_t exifOffset = 0, gpsOffset = 0;
+    bool valid = forEachEntry(tiff, ifd0, [&](const Entry &entry) {
+        if (entry.tag == 0x8769 && wantExifIfd) exifOffset = readUnsigned(tiff, entry);
+        else if (entry.tag == 0x8825 && wantGps) gpsOffset = readUnsigned(tiff, entry);
+        else if (entry.tag == 0x0112) readImageTag(static_cast<typename Record::ImageBase &>(out), tiff, entry);
+        else readCameraTag(static_cast<typename Record::CameraBase &>(out), tiff, entry);
+    });
+    if (!valid) return -3;
+
+    if (exifOffset)
+    {
+        forEachEntry(tiff, exifOffset, [&](const Entry &entry) {
+            readTimeTag(static_cast<typename Record::TimeBase &>(out), tiff, entry);
+            readImageTag(static_cast<typename Record::ImageBase &>(out), tiff, entry);
+            readExposureTag(static_cast<typename Record::ExposureBase &>(out), tiff, entry);
+        });
+    }
+    if (gpsOffset) readLocation(static_cast<typename Record::LocationBase &>(out), tiff, gpsOffset);
+    if (Fields & EXIF_THUMBNAIL)
+    {
+        uint32_t ifd1 = nextIfd(tiff, ifd0);
+        if (ifd1) readThumbnail(static_cast<typename Record::ThumbnailBase &>(out), tiff, ifd1);
+    }
+    return 0;
+}
+
+// Same for a JPEG, or the SOI/APP1/EOI buffer readImageHeader assembles:
+// finds the Exif APP1 segment and decodes its TIFF block. Returns 0, or -3
+// if there is no Exif segment or it doesn't decode.
+template <unsigned Fields>
+int decodeExif(const unsigned char *bytes, size_t length, ExifRecord<Fields> &out) {
+    if (length < 4 || bytes[0] != 0xFF || bytes[1] != 0xD8) return -3;
+    std::vector<JpegMarker> markers;
+    scanJpegMarkers(bytes, length, 2, false, markers);
+    const JpegMarker *exif = findExifMarker(markers, bytes, length);
+    if (!exif) return -3;
+    int status = decodeExifSegment(bytes + exif->offset + 10, exif->length - 8, out);
+    // The thumbnail span is relative to bytes, not to the TIFF block.
+    exif_decoder_detail::moveThumbnail(static_cast<typename ExifRecord<Fields>::ThumbnailBase &>(out),
+                                       exif->offset + 10);
+    return status;
+}
+
+#endif /* defined(__photo_exif_parsing__exif_decoder__) */
@@ -0,0 +1,106 @@
+//
+//  exif_time.cpp
+//  photo-exif-parsing
+//
+
+#include "exif_time.h"
+
+namespace {
+    const int64_t kNanosPerSecond = 1000000000LL;
+
+    inline bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    // Reads count digits at text; false if any of them isn't a digit.
+    inline bool readNumber(const char *text, int count, int &value) {
+        value = 0;
+        for (int i = 0; i < count; i++) {
+            if (!isDigit(text[i])) return false;
+            value = value * 10 + (text[i] - '0');
+        }
+        return true;
+    }
+
+    // Days from 1970-01-01 to the given proleptic Gregorian date.
+    int64_t daysFromCivil(int year, int month, int day) {
+        year -= month <= 2;
+        int64_t era = (year >= 0 ? year : year - 399) / 400;
+        int64_t yearOfEra = year - era * 400;
+        int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        return era * 146097 + dayOfEra - 719468;
+    }
+
+    int daysInMonth(int year, int month) {
+        static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+        if (month == 2 && (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))) return 29;
+        return days[month - 1];
+    }
+
+    // "+HH:MM", "-HH:MM", "+HHMM" or "Z" into seconds east of UTC.
+    bool parseOffset(const char *offset, int64_t &seconds) {
+        seconds = 0;
+        if (!offset || !*offset || (offset[0] == 'Z' && offset[1] == '\0')) return true;
+        if (offset[0] != '+' && offset[0] != '-') return false;
+
+        int hours, minutes;
+        if (!readNumber(offset + 1, 2, hours)) return false;
+        const char *rest = offset + 3;
+        if (*rest == ':') rest++;
+        if (!readNumber(rest, 2, minutes) || rest[2] != '\0') return false;
+        if (hours > 14 || minutes > 59) return false;
+
+        seconds = (int64_t)hours * 3600 + minutes * 60;
+        if (offset[0] == '-') seconds = -seconds;
+        return true;
+    }
+}
+
+int64_t parseExifTimestamp(const char *dateTime, const char *subSec, const char *offset) {
+    if (!dateTime) return kUnknownTime;
+
+    // Fixed layout: YYYY:MM:DD HH:MM:SS
+    //               0123456789012345678
+    int year, month, day, hour, minute, second;
+    if (!readNumber(dateTime, 4, year)) return kUnknownTime;
+    // Each check stops at the first mismatch, so a short string is never
+    // read past its terminator.
+    if (dateTime[4] != ':' && dateTime[4] != '-') return kUnknownTime;
+    if (!readNumber(dateTime + 5, 2, month) || dateTime[7] != dateTime[4]) return kUnknownTime;
+    if (!readNumber(dateTime + 8, 2, day)) return kUnknownTime;
+    if (dateTime[10] != ' ' && dateTime[10] != 'T') return kUnknownTime;
+    if (!readNumber(dateTime + 11, 2, hour) || dateTime[13] != ':') return kUnknownTime;
+    if (!readNumber(dateTime + 14, 2, minute) || dateTime[16] != ':') return kUnknownTime;
+    if (!readNumber(dateTime + 17, 2, second)) return kUnknownTime;
+
+    if (year == 0 || month < 1 || month > 12) return kUnknownTime;
+    if (day < 1 || day > daysInMonth(year, month)) return kUnknownTime;
+    if (hour > 23 || minute > 59 || second > 60) return kUnknownTime;
+
+    int64_t offsetSeconds;
+    if (!parseOffset(offset, offsetSeconds)) return kUnknownTime;
+
+    int64_t seconds = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    int64_t nanos = (seconds - offsetSeconds) * kNanosPerSecond;
+
+    if (subSec)
+    {
+        // Leading blanks show up in the wild; anything after the digits is ignored.
+        while (*subSec == ' ') subSec++;
+        int64_t scale = kNanosPerSecond / 10;
+        for (; isDigit(*subSec) && scale > 0; subSec++, scale /= 10) {
+            nanos += (*subSec - '0') * scale;
+        }
+    }
+    return nanos;
+}
+
+size_t parseExifTimestamps(const ExifTimeFields *fields, size_t count, int64_t *out) {
+    size_t parsed = 0;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = parseExifTimestamp(fields[i].dateTime, fields[i].subSec, fields[i].offset);
+        if (out[i] != kUnknownTime) parsed++;
+    }
+    return parsed;
+}
@@ -0,0 +1,46 @@
+//
+//  exif_time.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__exif_time__
+#define __photo_exif_parsing__exif_time__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Marks a capture time that is missing or could not be parsed.
+const int64_t kUnknownTime = INT64_MIN;
+
+// Parses an EXIF DateTimeOriginal ("YYYY:MM:DD HH:MM:SS"; '-' is accepted
+// in the date too) into nanoseconds since the Unix epoch, without touching
+// the heap or any locale.
+//
+// subSec holds the SubSecTimeOriginal digits (a fraction of a second, so
+// "5" is 500 ms) and offset the OffsetTimeOriginal ("+09:00", "-05:30" or
+// "Z"). Either may be null or empty. Without an offset the wall-clock time
+// is taken as UTC, which keeps photos from one camera correctly ordered.
+//
+// Returns kUnknownTime for malformed or out-of-range input, including the
+// all-zero and all-blank placeholders cameras write when the clock is unset.
+int64_t parseExifTimestamp(const char *dateTime, const char *subSec = nullptr,
+                           const char *offset = nullptr);
+
+inline int64_t parseExifTimestamp(const std::string &dateTime, const std::string &subSec,
+                                  const std::string &offset = std::string()) {
+    return parseExifTimestamp(dateTime.c_str(), subSec.c_str(), offset.c_str());
+}
+
+struct ExifTimeFields
+{
+    const char *dateTime;
+    const char *subSec;     // may be null
+    const char *offset;     // may be null
+};
+
+// Parses count timestamps into out (kUnknownTime where parsing fails) and
+// returns how many succeeded.
+size_t parseExifTimestamps(const ExifTimeFields *fields, size_t count, int64_t *out);
+
+#endif /* defined(__photo_exif_parsing__exif_time__) */
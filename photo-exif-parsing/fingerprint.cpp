@@ -0,0 +1,109 @@
+//
+//  fingerprint.cpp
+//  photo-exif-parsing
+//
+
+#include "fingerprint.h"
+#include "jpeg_markers.h"
+
+#include <string.h>
+#include <vector>
+
+namespace {
+    const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+    const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+    const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+    inline uint64_t rotate(uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    // Unaligned little-endian loads; memcpy compiles to a plain move.
+    inline uint64_t load64(const unsigned char *p) {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    inline uint32_t load32(const unsigned char *p) {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    inline uint64_t round(uint64_t lane, uint64_t input) {
+        lane += input * kPrime2;
+        return rotate(lane, 31) * kPrime1;
+    }
+
+    inline uint64_t mergeRound(uint64_t hash, uint64_t lane) {
+        hash ^= round(0, lane);
+        return hash * kPrime1 + kPrime4;
+    }
+}
+
+uint64_t hashBytes(const void *bytes, size_t length, uint64_t seed) {
+    const unsigned char *p = static_cast<const unsigned char *>(bytes);
+    const unsigned char *end = p + length;
+    uint64_t hash;
+
+    if (length >= 32)
+    {
+        uint64_t v1 = seed + kPrime1 + kPrime2;
+        uint64_t v2 = seed + kPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kPrime1;
+        for (; end - p >= 32; p += 32) {
+            v1 = round(v1, load64(p));
+            v2 = round(v2, load64(p + 8));
+            v3 = round(v3, load64(p + 16));
+            v4 = round(v4, load64(p + 24));
+        }
+        hash = rotate(v1, 1) + rotate(v2, 7) + rotate(v3, 12) + rotate(v4, 18);
+        hash = mergeRound(hash, v1);
+        hash = mergeRound(hash, v2);
+        hash = mergeRound(hash, v3);
+        hash = mergeRound(hash, v4);
+    }
+    else
+    {
+        hash = seed + kPrime5;
+    }
+    hash += length;
+
+    for (; end - p >= 8; p += 8) {
+        hash ^= round(0, load64(p));
+        hash = rotate(hash, 27) * kPrime1 + kPrime4;
+    }
+    if (end - p >= 4)
+    {
+        hash ^= (uint64_t)load32(p) * kPrime1;
+        hash = rotate(hash, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash ^= *p * kPrime5;
+        hash = rotate(hash, 11) * kPrime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t hashScanData(const unsigned char *bytes, size_t length) {
+    if (length < 4 || bytes[0] != 0xFF || bytes[1] != 0xD8) return 0;
+    std::vector<JpegMarker> markers;
+    scanJpegMarkers(bytes, length, 2, false, markers);
+    if (markers.empty() || markers.back().code != 0xDA) return 0;
+    size_t start = markers.back().offset;
+    if (start >= length) return 0;
+    uint64_t hash = hashBytes(bytes + start, length - start);
+    // 0 means "no fingerprint" to callers.
+    return hash ? hash : 1;
+}
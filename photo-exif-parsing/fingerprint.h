@@ -0,0 +1,24 @@
+//
+//  fingerprint.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__fingerprint__
+#define __photo_exif_parsing__fingerprint__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 64-bit non-cryptographic hash of length bytes (the xxHash64 algorithm:
+// four independent lanes over 32-byte stripes, so it runs at memory speed
+// on large inputs). Chaining the previous hash in as seed hashes several
+// pieces as one fingerprint.
+uint64_t hashBytes(const void *bytes, size_t length, uint64_t seed = 0);
+
+// Hash of a JPEG's entropy-coded data: everything from the first SOS
+// marker to the end of bytes. Re-exports and renames that keep the
+// compressed image but rewrite metadata still match. Returns 0 when bytes
+// don't reach an SOS, e.g. a header-only read.
+uint64_t hashScanData(const unsigned char *bytes, size_t length);
+
+#endif /* defined(__photo_exif_parsing__fingerprint__) */
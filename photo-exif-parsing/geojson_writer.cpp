@@ -0,0 +1,83 @@
+//
+//  geojson_writer.cpp
+//  photo-exif-parsing
+//
+
+#include "geojson_writer.h"
+
+#include <string.h>
+#include <cmath>
+
+GeoJSONWriter::GeoJSONWriter(size_t bufferSize)
+: fp(nullptr), bufferSize(bufferSize), features(0)
+{
+}
+
+GeoJSONWriter::~GeoJSONWriter() {
+    close();
+}
+
+int GeoJSONWriter::open(const char *fileName) {
+    close();
+    fp = fopen(fileName, "wb");
+    if (!fp) return -1;
+    setvbuf(fp, nullptr, _IOFBF, bufferSize);
+    features = 0;
+    write("{\n   \"features\" : [");
+    return 0;
+}
+
+void GeoJSONWriter::write(const char *text) {
+    fputs(text, fp);
+}
+
+// Same text as Json::valueToString(double), without the std::string.
+void GeoJSONWriter::writeNumber(double value) {
+    char buffer[32];
+    if (std::isfinite(value))
+    {
+        snprintf(buffer, sizeof(buffer), "%.17g", value);
+        // Undo a decimal comma from the C locale, as jsoncpp does.
+        for (char *c = buffer; *c; c++) {
+            if (*c == ',') *c = '.';
+        }
+    }
+    else if (value != value)
+    {
+        strcpy(buffer, "null");
+    }
+    else
+    {
+        strcpy(buffer, value < 0 ? "-1e+9999" : "1e+9999");
+    }
+    fputs(buffer, fp);
+}
+
+void GeoJSONWriter::addPoint(double longitude, double latitude) {
+    if (!fp) return;
+    write(features ? ",\n" : "\n");
+    write("      {\n"
+          "         \"geometry\" : {\n"
+          "            \"coordinates\" : [ ");
+    writeNumber(longitude);
+    write(", ");
+    writeNumber(latitude);
+    write(" ],\n"
+          "            \"type\" : \"Point\"\n"
+          "         },\n"
+          "         \"properties\" : null,\n"
+          "         \"type\" : \"Feature\"\n"
+          "      }");
+    features++;
+}
+
+int GeoJSONWriter::close() {
+    if (!fp) return 0;
+    // An empty collection gets [] where StyledWriter printed null.
+    write(features ? "\n   ],\n" : "],\n");
+    write("   \"type\" : \"FeatureCollection\"\n}\n");
+    bool failed = ferror(fp) != 0;
+    if (fclose(fp) != 0) failed = true;
+    fp = nullptr;
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,50 @@
+//
+//  geojson_writer.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__geojson_writer__
+#define __photo_exif_parsing__geojson_writer__
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Writes a GeoJSON FeatureCollection of Point features one feature at a
+// time, straight into a buffered file. The text matches what
+// Json::StyledWriter produced for the Json::Value tree writeJSON used to
+// build (same keys, order, indentation and number formatting), but no tree
+// or whole-document string is ever held in memory.
+//
+// Not thread-safe; callers serialize features themselves.
+class GeoJSONWriter
+{
+public:
+    explicit GeoJSONWriter(size_t bufferSize = 1 << 20);
+    ~GeoJSONWriter();
+
+    // Creates fileName and writes the opening of the collection. Returns 0
+    // or -1 if the file can't be created.
+    int open(const char *fileName);
+    bool isOpen() const { return fp != nullptr; }
+
+    void addPoint(double longitude, double latitude);
+
+    // Closes the features array and the collection. Returns 0 or -1 if any
+    // write failed.
+    int close();
+
+    size_t featureCount() const { return features; }
+
+private:
+    void write(const char *text);
+    void writeNumber(double value);
+
+    FILE *fp;
+    size_t bufferSize;
+    size_t features;
+
+    GeoJSONWriter(const GeoJSONWriter &);
+    GeoJSONWriter &operator=(const GeoJSONWriter &);
+};
+
+#endif /* defined(__photo_exif_parsing__geojson_writer__) */
@@ -0,0 +1,202 @@
+//
+//  heif_boxes.cpp
+//  photo-exif-parsing
+//
+
+#include "heif_boxes.h"
+
+namespace {
+    // Sequential big-endian reads over one box's contents. Reads past the
+    // end return 0 and set failed, so a walk checks once at the end.
+    class BoxReader
+    {
+    public:
+        BoxReader(const unsigned char *bytes, size_t length)
+        : bytes(bytes), length(length), pos(0), failed(false) {}
+
+        uint64_t read(unsigned size) {
+            if (size > length - pos || length < pos)
+            {
+                failed = true;
+                pos = length;
+                return 0;
+            }
+            uint64_t value = 0;
+            for (unsigned i = 0; i < size; i++) value = value << 8 | bytes[pos + i];
+            pos += size;
+            return value;
+        }
+
+        size_t position() const { return pos; }
+        bool ok() const { return !failed; }
+
+    private:
+        const unsigned char *bytes;
+        size_t length;
+        size_t pos;
+        bool failed;
+    };
+
+    // Calls visit(box, offset) for each child box in bytes[0, length) until
+    // it returns false or a header is malformed.
+    template <typename Visit>
+    void forEachBox(const unsigned char *bytes, size_t length, Visit visit) {
+        for (size_t pos = 0; pos + 8 <= length; ) {
+            IsoBox box;
+            if (!readBoxHeader(bytes + pos, length - pos, length - pos, box)) return;
+            if (!visit(box, pos)) return;
+            pos += box.size;
+        }
+    }
+
+    // The item id of the first infe entry of type Exif, or 0.
+    uint32_t findExifItemId(const unsigned char *iinf, size_t length) {
+        BoxReader reader(iinf, length);
+        unsigned version = (unsigned)reader.read(1);
+        reader.read(3);
+        reader.read(version == 0 ? 2 : 4);
+        if (!reader.ok()) return 0;
+
+        uint32_t found = 0;
+        size_t start = reader.position();
+        forEachBox(iinf + start, length - start, [&](const IsoBox &box, size_t offset) {
+            if (box.type != fourCC("infe")) return true;
+            BoxReader entry(iinf + start + offset + box.headerSize, box.size - box.headerSize);
+            unsigned entryVersion = (unsigned)entry.read(1);
+            entry.read(3);
+            // Versions 0 and 1 carry no item type.
+            if (entryVersion < 2) return true;
+            uint32_t itemId = (uint32_t)entry.read(entryVersion == 2 ? 2 : 4);
+            entry.read(2);
+            uint32_t itemType = (uint32_t)entry.read(4);
+            if (entry.ok() && itemType == fourCC("Exif"))
+            {
+                found = itemId;
+                return false;
+            }
+            return true;
+        });
+        return found;
+    }
+
+    bool findItemExtents(const unsigned char *iloc, size_t length, uint32_t itemId,
+                         uint64_t idatOffset, std::vector<HeifExtent> &extents) {
+        BoxReader reader(iloc, length);
+        unsigned version = (unsigned)reader.read(1);
+        reader.read(3);
+        unsigned sizes = (unsigned)reader.read(1);
+        unsigned offsetSize = sizes >> 4, lengthSize = sizes & 15;
+        sizes = (unsigned)reader.read(1);
+        unsigned baseOffsetSize = sizes >> 4, indexSize = version >= 1 ? sizes & 15 : 0;
+        uint32_t itemCount = (uint32_t)reader.read(version < 2 ? 2 : 4);
+
+        for (uint32_t i = 0; i < itemCount && reader.ok(); i++) {
+            uint32_t id = (uint32_t)reader.read(version < 2 ? 2 : 4);
+            unsigned constructionMethod = version >= 1 ? (unsigned)reader.read(2) & 15 : 0;
+            unsigned dataReference = (unsigned)reader.read(2);
+            uint64_t baseOffset = reader.read(baseOffsetSize);
+            unsigned extentCount = (unsigned)reader.read(2);
+            bool wanted = id == itemId;
+            for (unsigned e = 0; e < extentCount && reader.ok(); e++) {
+                reader.read(indexSize);
+                HeifExtent extent;
+                extent.offset = baseOffset + reader.read(offsetSize);
+                extent.length = reader.read(lengthSize);
+                if (wanted) extents.push_back(extent);
+            }
+            if (!wanted) continue;
+
+            // Method 0 is file offsets, 1 offsets into idat; 2 builds the
+            // item out of other items. The extents of an item that can't be
+            // followed mean nothing as file offsets, so none are returned.
+            bool usable = reader.ok() && dataReference == 0 && constructionMethod <= 1 &&
+                          (constructionMethod == 0 || idatOffset) && !extents.empty();
+            // A length of 0 means "to the end of the file", which only an
+            // item in mdat would use and an Exif item never does.
+            for (size_t e = 0; e < extents.size() && usable; e++) {
+                usable = extents[e].length != 0;
+            }
+            if (!usable)
+            {
+                extents.clear();
+                return false;
+            }
+            if (constructionMethod == 1)
+            {
+                for (size_t e = 0; e < extents.size(); e++) extents[e].offset += idatOffset;
+            }
+            return true;
+        }
+        extents.clear();
+        return false;
+    }
+}
+
+bool readBoxHeader(const unsigned char *bytes, size_t length, uint64_t remaining, IsoBox &box) {
+    BoxReader reader(bytes, length);
+    box.size = reader.read(4);
+    box.type = (uint32_t)reader.read(4);
+    box.headerSize = 8;
+    if (box.size == 1)
+    {
+        box.size = reader.read(8);
+        box.headerSize = 16;
+    }
+    else if (box.size == 0)
+    {
+        box.size = remaining;
+    }
+    return reader.ok() && box.size >= box.headerSize && box.size <= remaining;
+}
+
+bool isHeifFile(const unsigned char *head, size_t length) {
+    if (length < 12) return false;
+    BoxReader reader(head, length);
+    reader.read(4);
+    if (reader.read(4) != fourCC("ftyp")) return false;
+    uint32_t brand = (uint32_t)reader.read(4);
+    static const char *const kBrands[] = {
+        "heic", "heix", "heim", "heis", "hevc", "hevx", "mif1", "msf1", "avif"
+    };
+    for (size_t i = 0; i < sizeof(kBrands) / sizeof(kBrands[0]); i++) {
+        if (brand == fourCC(kBrands[i])) return true;
+    }
+    return false;
+}
+
+bool findHeifExifItem(const unsigned char *meta, size_t length, uint64_t metaOffset,
+                      std::vector<HeifExtent> &extents) {
+    extents.clear();
+    // meta is a full box: version and flags come before its children.
+    if (length < 4) return false;
+    const unsigned char *children = meta + 4;
+    size_t childLength = length - 4;
+
+    const unsigned char *iinf = nullptr, *iloc = nullptr;
+    size_t iinfLength = 0, ilocLength = 0;
+    uint64_t idatOffset = 0;
+    forEachBox(children, childLength, [&](const IsoBox &box, size_t offset) {
+        const unsigned char *contents = children + offset + box.headerSize;
+        size_t contentLength = box.size - box.headerSize;
+        if (box.type == fourCC("iinf"))
+        {
+            iinf = contents;
+            iinfLength = contentLength;
+        }
+        else if (box.type == fourCC("iloc"))
+        {
+            iloc = contents;
+            ilocLength = contentLength;
+        }
+        else if (box.type == fourCC("idat"))
+        {
+            idatOffset = metaOffset + (contents - meta);
+        }
+        return true;
+    });
+    if (!iinf || !iloc) return false;
+
+    uint32_t itemId = findExifItemId(iinf, iinfLength);
+    if (!itemId) return false;
+    return findItemExtents(iloc, ilocLength, itemId, idatOffset, extents);
+}
@@ -0,0 +1,56 @@
+//
+//  heif_boxes.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__heif_boxes__
+#define __photo_exif_parsing__heif_boxes__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Parsing of the ISOBMFF boxes HEIF/HEIC files keep their metadata in. It
+// works on bytes already in memory; the reader decides what to fetch.
+
+// Four-character box and item types, as the big-endian number the file
+// stores them as.
+inline uint32_t fourCC(const char *code) {
+    return (uint32_t)(unsigned char)code[0] << 24 | (uint32_t)(unsigned char)code[1] << 16 |
+           (uint32_t)(unsigned char)code[2] << 8 | (uint32_t)(unsigned char)code[3];
+}
+
+struct IsoBox
+{
+    uint32_t type;
+    uint64_t size;          // header included
+    uint32_t headerSize;    // 8, or 16 with a 64-bit size
+};
+
+// Reads the box header at the start of bytes. remaining is how far the
+// enclosing box or file extends from there, which a size of 0 ("to the
+// end") is resolved against. Returns false when the header doesn't fit in
+// length bytes or the size is impossible.
+bool readBoxHeader(const unsigned char *bytes, size_t length, uint64_t remaining, IsoBox &box);
+
+// True for files that start with an ftyp box naming a HEIF brand (heic,
+// heix, mif1, ...). head is the first bytes of the file, 12 is enough.
+bool isHeifFile(const unsigned char *head, size_t length);
+
+// A piece of an item, as a file offset and length.
+struct HeifExtent
+{
+    uint64_t offset;
+    uint64_t length;
+};
+
+// Finds the item of type Exif in the contents of a meta box (what follows
+// its box header) through iinf, and where its bytes are through iloc.
+// metaOffset is the file offset of meta[0], used for items stored in the
+// box's own idat. Returns false, leaving extents empty, when there is no
+// Exif item or it is stored in a way this doesn't follow (a data reference
+// to another file, or built from other items).
+bool findHeifExifItem(const unsigned char *meta, size_t length, uint64_t metaOffset,
+                      std::vector<HeifExtent> &extents);
+
+#endif /* defined(__photo_exif_parsing__heif_boxes__) */
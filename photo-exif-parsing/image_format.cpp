@@ -0,0 +1,21 @@
+//
+//  image_format.cpp
+//  photo-exif-parsing
+//
+
+#include "image_format.h"
+#include "heif_boxes.h"
+
+#include <string.h>
+
+ImageFormat sniffImageFormat(const unsigned char *head, size_t length) {
+    if (length >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF) return FORMAT_JPEG;
+    if (length >= 4 && (memcmp(head, "II*\0", 4) == 0 || memcmp(head, "MM\0*", 4) == 0)) return FORMAT_TIFF;
+    if (length >= 8 && memcmp(head + 4, "ftyp", 4) == 0)
+    {
+        return isHeifFile(head, length) ? FORMAT_HEIF : FORMAT_ISOBMFF;
+    }
+    if (length >= 8 && memcmp(head, "\x89PNG\r\n\x1A\n", 8) == 0) return FORMAT_PNG;
+    if (length >= 12 && memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "WEBP", 4) == 0) return FORMAT_WEBP;
+    return FORMAT_UNKNOWN;
+}
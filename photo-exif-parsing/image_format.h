@@ -0,0 +1,35 @@
+//
+//  image_format.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__image_format__
+#define __photo_exif_parsing__image_format__
+
+#include <stddef.h>
+
+// What a file is, going by its first bytes rather than its name.
+enum ImageFormat
+{
+    FORMAT_UNKNOWN,
+    FORMAT_JPEG,        // FF D8 FF
+    FORMAT_TIFF,        // "II*\0" or "MM\0*", which camera raw files use too
+    FORMAT_HEIF,        // ISOBMFF ftyp with a HEIF brand
+    FORMAT_ISOBMFF,     // any other ftyp: MP4, MOV, ...
+    FORMAT_PNG,         // 89 "PNG" 0D 0A 1A 0A
+    FORMAT_WEBP,        // "RIFF" size "WEBP"
+    FORMAT_COUNT
+};
+
+// Bytes sniffImageFormat looks at; fewer are fine for a short file.
+const size_t kSniffLength = 16;
+
+ImageFormat sniffImageFormat(const unsigned char *head, size_t length);
+
+// Whether the readers can get Exif out of the format. Everything else is
+// counted as unsupportedFiles and reported as -4.
+inline bool canReadExif(ImageFormat format) {
+    return format != FORMAT_UNKNOWN && format != FORMAT_ISOBMFF;
+}
+
+#endif /* defined(__photo_exif_parsing__image_format__) */
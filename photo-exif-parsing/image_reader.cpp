@@ -0,0 +1,439 @@
+//
+//  image_reader.cpp
+//  photo-exif-parsing
+//
+
+#include "image_reader.h"
+#include "heif_boxes.h"
+#include "image_format.h"
+#include "jpeg_markers.h"
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace {
+    // A window of [offset, offset + data.size()) bytes of an open file that
+    // is refilled on demand. Each refill reads twice as much as the last one.
+    class HeaderWindow
+    {
+    public:
+        HeaderWindow(FILE *fp, unsigned long fileSize, HeaderReadStats &stats)
+        : fp(fp), fileSize(fileSize), stats(stats), offset(0),
+          nextRead(kInitialHeaderRead), failed(false) {}
+
+        // Makes [at, at + count) resident and returns a pointer to it, or
+        // nullptr when the range runs past the end of the file or the read
+        // fails.
+        const unsigned char *fetch(unsigned long at, size_t count) {
+            // Offsets come from the file, so at + count may wrap.
+            if (at > fileSize || count > fileSize - at) return nullptr;
+            if (at >= offset && at + count <= offset + data.size()) {
+                return data.data() + (at - offset);
+            }
+
+            size_t want = std::max(count, nextRead);
+            if (at + want > fileSize) want = fileSize - at;
+            // Nothing in the old window is kept, so nothing gets copied.
+            data.clear();
+            data.resize(want);
+            if (fseek(fp, (long)at, SEEK_SET) != 0 || fread(data.data(), 1, want, fp) != want)
+            {
+                failed = true;
+                data.clear();
+                return nullptr;
+            }
+            offset = at;
+            nextRead = want * 2;
+            stats.bytesRead += want;
+            stats.reads++;
+            return data.data();
+        }
+
+        // Bytes resident from at, which the last fetch made resident.
+        size_t resident(unsigned long at) const { return offset + data.size() - at; }
+
+        // Whether the file ends where the caller's available count says.
+        bool endKnown() const { return true; }
+        bool readFailed() const { return failed; }
+
+    private:
+        FILE *fp;
+        unsigned long fileSize;
+        HeaderReadStats &stats;
+        unsigned long offset;
+        size_t nextRead;
+        bool failed;
+        ReadBuffer data;
+    };
+
+    // The leading bytes of a file that were read by someone else. Fetches
+    // past the end of the prefix fail, and record whether the file itself
+    // continues beyond it.
+    class PrefixSource
+    {
+    public:
+        PrefixSource(const unsigned char *bytes, size_t length, bool wholeFile)
+        : bytes(bytes), length(length), wholeFile(wholeFile), truncated(false) {}
+
+        const unsigned char *fetch(unsigned long at, size_t count) {
+            if (at > length || count > length - at)
+            {
+                if (!wholeFile) truncated = true;
+                return nullptr;
+            }
+            return bytes + at;
+        }
+
+        size_t resident(unsigned long at) const { return length - at; }
+
+        bool endKnown() const { return wholeFile; }
+        bool readFailed() const { return false; }
+        bool needsMore() const { return truncated; }
+
+    private:
+        const unsigned char *bytes;
+        size_t length;
+        bool wholeFile;
+        bool truncated;
+    };
+
+    const unsigned char kSOI[] = { 0xFF, 0xD8 };
+    const unsigned char kEOI[] = { 0xFF, 0xD9 };
+
+    // An APP1 segment holds at most this many bytes of TIFF after its
+    // length field and "Exif\0\0".
+    const size_t kMaxTiffInApp1 = 0xFFFF - 2 - 6;
+
+    // Metadata boxes past this size are not believed.
+    const uint64_t kMaxMetaBox = 16 << 20;
+
+    inline uint32_t bigEndian32(const unsigned char *p) {
+        return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    }
+
+    inline uint32_t littleEndian32(const unsigned char *p) {
+        return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+    }
+
+    // Fills buffer with SOI, an APP1 "Exif" segment holding the TIFF block
+    // and EOI, so Exif found in any container reaches the decoders exactly
+    // like a JPEG's; without a usable block it is just SOI/EOI. Some
+    // writers put "Exif\0\0" in front of the block, which is dropped.
+    // tiffOffset is where the block is in the file, 0 if it isn't there in
+    // one piece. Returns where a JPEG's APP1 marker would be for the block
+    // to land at tiffOffset, or 0.
+    unsigned long wrapTiffBlock(const unsigned char *tiff, size_t length, unsigned long tiffOffset,
+                                ReadBuffer &buffer) {
+        if (length >= 6 && memcmp(tiff, "Exif\0\0", 6) == 0)
+        {
+            tiff += 6;
+            length -= 6;
+            if (tiffOffset) tiffOffset += 6;
+        }
+        buffer.append(kSOI, sizeof(kSOI));
+        unsigned long found = 0;
+        if (tiff && length >= 8 && length <= kMaxTiffInApp1)
+        {
+            size_t segmentLength = 2 + 6 + length;
+            const unsigned char app1[] = {
+                0xFF, 0xE1, (unsigned char)(segmentLength >> 8), (unsigned char)segmentLength,
+                'E', 'x', 'i', 'f', 0, 0
+            };
+            buffer.append(app1, sizeof(app1));
+            buffer.append(tiff, length);
+            if (tiffOffset >= 10) found = tiffOffset - 10;
+        }
+        buffer.append(kEOI, sizeof(kEOI));
+        return found;
+    }
+
+    // The HEIF counterpart of the JPEG marker walk: steps over the
+    // top-level boxes by their headers to meta, fetches meta whole, looks
+    // the Exif item up in it and fetches only that item's extents.
+    template <typename Source>
+    unsigned long assembleHeifExif(Source &source, unsigned long available,
+                                   ReadBuffer &buffer) {
+        // A prefix can't bound the boxes. Whatever lies past it is fetched
+        // anyway, which fails and has the caller read the file itself.
+        uint64_t end = source.endKnown() ? available : UINT64_MAX;
+        std::vector<HeifExtent> extents;
+        for (unsigned long pos = 0; ; ) {
+            // Room for a 64-bit size where the file has it.
+            const unsigned char *header = source.fetch(pos, end - pos >= 16 ? 16 : 8);
+            IsoBox box;
+            if (!header || !readBoxHeader(header, source.resident(pos), end - pos, box)) break;
+            if (box.type == fourCC("meta"))
+            {
+                if (box.size > kMaxMetaBox) break;
+                const unsigned char *meta = source.fetch(pos, (size_t)box.size);
+                if (meta && !findHeifExifItem(meta + box.headerSize, (size_t)(box.size - box.headerSize),
+                                              pos + box.headerSize, extents))
+                {
+                    extents.clear();
+                }
+                break;
+            }
+            // mdat and the like are stepped over, not read.
+            if (box.size >= end - pos) break;
+            pos += box.size;
+        }
+
+        // The item is 4 bytes giving where the TIFF header starts after
+        // them, then usually "Exif\0\0", then the TIFF block.
+        ReadBuffer item;
+        for (size_t i = 0; i < extents.size(); i++) {
+            const HeifExtent &extent = extents[i];
+            const unsigned char *bytes = nullptr;
+            if (extent.length <= 0xFFFF && extent.offset <= end && extent.length <= end - extent.offset)
+            {
+                bytes = source.fetch((unsigned long)extent.offset, (size_t)extent.length);
+            }
+            if (!bytes)
+            {
+                item.clear();
+                break;
+            }
+            item.append(bytes, (size_t)extent.length);
+        }
+
+        size_t tiffStart = item.size() >= 4 ? 4 + (size_t)bigEndian32(item.data()) : 0;
+        if (!tiffStart || tiffStart > item.size()) return wrapTiffBlock(nullptr, 0, 0, buffer);
+        unsigned long tiffOffset = extents.size() == 1 ? (unsigned long)extents[0].offset + tiffStart : 0;
+        return wrapTiffBlock(item.data() + tiffStart, item.size() - tiffStart, tiffOffset, buffer);
+    }
+
+    // PNG keeps Exif in an eXIf chunk, which has to come before the image
+    // data; the walk steps over chunks by their headers and stops at IDAT.
+    template <typename Source>
+    unsigned long assemblePngExif(Source &source, ReadBuffer &buffer) {
+        for (unsigned long pos = 8; ; ) {
+            const unsigned char *header = source.fetch(pos, 8);
+            if (!header) break;
+            uint32_t length = bigEndian32(header);
+            uint32_t type = bigEndian32(header + 4);
+            if (type == fourCC("IDAT") || type == fourCC("IEND")) break;
+            if (type == fourCC("eXIf"))
+            {
+                const unsigned char *data = length <= 0xFFFF ? source.fetch(pos + 8, length) : nullptr;
+                if (data) return wrapTiffBlock(data, length, pos + 8, buffer);
+                break;
+            }
+            // Header, data and CRC.
+            pos += 12 + (unsigned long)length;
+        }
+        return wrapTiffBlock(nullptr, 0, 0, buffer);
+    }
+
+    // WebP keeps Exif in an EXIF chunk after the image data. Only the
+    // extended format (a leading VP8X chunk with its Exif flag set) has
+    // one, and the image chunks are stepped over by their headers.
+    template <typename Source>
+    unsigned long assembleWebpExif(Source &source, ReadBuffer &buffer) {
+        const unsigned char *first = source.fetch(12, 9);
+        if (!first || bigEndian32(first) != fourCC("VP8X") || !(first[8] & 0x08))
+        {
+            return wrapTiffBlock(nullptr, 0, 0, buffer);
+        }
+        for (unsigned long pos = 12; ; ) {
+            const unsigned char *header = source.fetch(pos, 8);
+            if (!header) break;
+            uint32_t type = bigEndian32(header);
+            uint32_t length = littleEndian32(header + 4);
+            if (type == fourCC("EXIF"))
+            {
+                const unsigned char *data = length <= 0xFFFF ? source.fetch(pos + 8, length) : nullptr;
+                if (data) return wrapTiffBlock(data, length, pos + 8, buffer);
+                break;
+            }
+            // Chunks are padded to an even length.
+            pos += 8 + (unsigned long)length + (length & 1);
+        }
+        return wrapTiffBlock(nullptr, 0, 0, buffer);
+    }
+
+    // A TIFF file, camera raw formats included, is itself the TIFF block.
+    // IFD0 and the Exif and GPS IFDs sit near its start, so the first
+    // 64 KB are handed over and entries pointing further are not read.
+    template <typename Source>
+    unsigned long assembleTiffExif(Source &source, unsigned long available, ReadBuffer &buffer) {
+        size_t length = (size_t)std::min<unsigned long>(available, kMaxTiffInApp1);
+        const unsigned char *tiff = source.fetch(0, length);
+        return wrapTiffBlock(tiff, tiff ? length : 0, 0, buffer);
+    }
+
+    // Walks the JPEG markers exposed by source and fills buffer as described
+    // for readImageHeader, handing other formats to their own walks by the
+    // first bytes. available is the number of bytes source can deliver
+    // from offset 0. Returns where the Exif APP1 marker is, or 0.
+    template <typename Source>
+    unsigned long assembleExifBuffer(Source &source, unsigned long available,
+                                     ReadBuffer &buffer) {
+        buffer.clear();
+        if (available == 0) return 0;
+
+        // The sniffed bytes come out of the first read the walks need anyway.
+        unsigned long headLength = std::min<unsigned long>(available, kSniffLength);
+        const unsigned char *head = source.fetch(0, headLength);
+        ImageFormat format = head ? sniffImageFormat(head, headLength) : FORMAT_UNKNOWN;
+        if (format == FORMAT_HEIF) return assembleHeifExif(source, available, buffer);
+        if (format == FORMAT_PNG) return assemblePngExif(source, buffer);
+        if (format == FORMAT_WEBP) return assembleWebpExif(source, buffer);
+        if (format == FORMAT_TIFF) return assembleTiffExif(source, available, buffer);
+        if (!head || available < 2 || head[0] != 0xFF || head[1] != 0xD8)
+        {
+            // Nothing we read. Hand back what we have so the parser can say so.
+            if (head) buffer.assign(head, headLength);
+            return 0;
+        }
+
+        // Each pass lists the markers in whatever is resident and resumes
+        // past the last one, so segments that don't matter are skipped by
+        // seeking instead of being read.
+        std::vector<JpegMarker> markers;
+        unsigned long pos = 2;
+        for (bool done = false; !done; ) {
+            const unsigned char *window = source.fetch(pos, 4);
+            if (!window) break;
+            markers.clear();
+            size_t next = scanJpegMarkers(window, source.resident(pos), 0, false, markers);
+            if (next == 0) break;
+
+            for (size_t i = 0; i < markers.size() && !done; i++) {
+                const JpegMarker &marker = markers[i];
+                if (marker.code == 0xDA || marker.code == 0xD9)
+                {
+                    // Entropy-coded data starts at SOS; nothing after it is metadata.
+                    done = true;
+                }
+                else if (marker.code == 0xE1 && marker.length >= 8)
+                {
+                    const unsigned char *segment = source.fetch(pos + marker.offset, marker.end() - marker.offset);
+                    if (!segment)
+                    {
+                        done = true;
+                    }
+                    else if (memcmp(segment + 4, "Exif\0\0", 6) == 0)
+                    {
+                        buffer.reserve(sizeof(kSOI) + 2 + marker.length + sizeof(kEOI));
+                        buffer.append(kSOI, sizeof(kSOI));
+                        buffer.append(segment, 2 + marker.length);
+                        buffer.append(kEOI, sizeof(kEOI));
+                        return pos + marker.offset;
+                    }
+                }
+            }
+            pos += next;
+        }
+
+        buffer.append(kSOI, sizeof(kSOI));
+        buffer.append(kEOI, sizeof(kEOI));
+        return 0;
+    }
+}
+
+int readImageHeader(const char *fileName, ReadBuffer &buffer,
+                    HeaderReadStats *stats) {
+    HeaderReadStats localStats;
+    if (!stats) stats = &localStats;
+    memset(stats, 0, sizeof(*stats));
+    buffer.clear();
+
+    StageClock clock;
+    FILE *fp = fopen(fileName, "rb");
+    if (!fp) return -1;
+    fseek(fp, 0, SEEK_END);
+    stats->fileSize = ftell(fp);
+    clock.lap(STAGE_OPEN);
+
+    HeaderWindow window(fp, stats->fileSize, *stats);
+    stats->exifOffset = assembleExifBuffer(window, stats->fileSize, buffer);
+    fclose(fp);
+    clock.lap(STAGE_READ);
+    countMetric(COUNT_BYTES_READ, stats->bytesRead);
+    return window.readFailed() ? -2 : 0;
+}
+
+int readWholeFile(const char *fileName, ReadBuffer &buffer) {
+    buffer.clear();
+    StageClock clock;
+    FILE *fp = fopen(fileName, "rb");
+    if (!fp) return -1;
+    fseek(fp, 0, SEEK_END);
+    unsigned long fsize = ftell(fp);
+    rewind(fp);
+    clock.lap(STAGE_OPEN);
+
+    // A file nothing is read from stops after the sniffed bytes, and only
+    // a file worth reading gets a buffer of its full size.
+    size_t headLength = std::min<size_t>(fsize, kSniffLength);
+    buffer.resize(headLength);
+    if (fread(buffer.data(), 1, headLength, fp) != headLength)
+    {
+        fclose(fp);
+        buffer.clear();
+        return -2;
+    }
+    if (canReadExif(sniffImageFormat(buffer.data(), headLength))) buffer.resize(fsize);
+    else fsize = headLength;
+    if (fsize > headLength && fread(buffer.data() + headLength, 1, fsize - headLength, fp) != fsize - headLength)
+    {
+        fclose(fp);
+        buffer.clear();
+        return -2;
+    }
+    fclose(fp);
+    clock.lap(STAGE_READ);
+    countMetric(COUNT_BYTES_READ, fsize);
+    return 0;
+}
+
+bool extractExifSegment(const unsigned char *prefix, size_t length, bool wholeFile,
+                        ReadBuffer &buffer, unsigned long *exifOffset) {
+    PrefixSource source(prefix, length, wholeFile);
+    unsigned long found = assembleExifBuffer(source, length, buffer);
+    if (exifOffset) *exifOffset = found;
+    return !source.needsMore();
+}
+
+int MappedImage::open(const char *fileName) {
+    close();
+
+    int fd = ::open(fileName, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return -2;
+    }
+    if (st.st_size == 0)
+    {
+        // mmap refuses empty files; an empty mapping parses as "no JPEG".
+        ::close(fd);
+        return 0;
+    }
+
+    void *mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) return -2;
+
+    bytes = static_cast<unsigned char *>(mapped);
+    length = (size_t)st.st_size;
+
+    madvise(bytes, length, MADV_RANDOM);
+    madvise(bytes, std::min(length, kInitialHeaderRead), MADV_WILLNEED);
+    return 0;
+}
+
+void MappedImage::close() {
+    if (bytes) munmap(bytes, length);
+    bytes = nullptr;
+    length = 0;
+}
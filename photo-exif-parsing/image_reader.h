@@ -0,0 +1,103 @@
+//
+//  image_reader.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__image_reader__
+#define __photo_exif_parsing__image_reader__
+
+#include <stddef.h>
+#include <vector>
+
+#include "buffer_pool.h"
+
+enum ReadMode
+{
+    READ_WHOLE_FILE,    // slurp the entire file, as parseImage always did
+    READ_HEADER_ONLY,   // read only as far as the EXIF APP1 segment
+    READ_MMAP           // parse straight out of a read-only file mapping
+};
+
+// Size of the first read in READ_HEADER_ONLY mode. Camera JPEGs put APP1
+// right after SOI, so one read of this size is enough for almost every file.
+const size_t kInitialHeaderRead = 64 * 1024;
+
+struct HeaderReadStats
+{
+    unsigned long fileSize;     // size of the file on disk
+    unsigned long bytesRead;    // bytes actually pulled from the file
+    unsigned reads;             // number of fread calls issued
+    unsigned long exifOffset;   // where the Exif APP1 marker is in the file,
+                                // 0 when there is none; for HEIF, where it
+                                // would be for the TIFF block to sit where
+                                // the Exif item has it, 0 if that is split
+};
+
+// Walks the JPEG markers of fileName and reads only up to and including the
+// first APP1 segment carrying EXIF data. Segments before it are skipped by
+// seeking, and every refill doubles the read size so a late APP1 costs a
+// handful of reads rather than one per segment.
+//
+// On success buffer holds a minimal JPEG that EXIFInfo::parseFrom accepts:
+// SOI, the EXIF APP1 segment and EOI. When the file has no EXIF segment the
+// buffer is just SOI/EOI, and when it is not a JPEG at all it holds the
+// leading bytes of the file, so parseFrom reports the usual error codes.
+//
+// Files are told apart by their first kSniffLength bytes, which come out
+// of the first read, and other formats are walked their own way with the
+// same positioned reads. The Exif TIFF block comes back wrapped in the
+// same SOI/APP1/EOI buffer, whatever held it:
+//
+//  - HEIF/HEIC: the top-level boxes are stepped over to meta, and only
+//    meta and the Exif item it points to are read, never the image data.
+//  - PNG: chunks are stepped over up to an eXIf chunk or IDAT.
+//  - WebP: chunks are stepped over to the EXIF chunk when VP8X says there
+//    is one.
+//  - TIFF and TIFF-based raw files: the first 64 KB are the TIFF block.
+//
+// Anything else comes back as its leading bytes, which the decoders
+// report as -4.
+//
+// Returns 0, -1 if the file can't be opened or -2 if it can't be read.
+int readImageHeader(const char *fileName, ReadBuffer &buffer,
+                    HeaderReadStats *stats = nullptr);
+
+// Reads all of fileName into buffer, timing the open and read stages. A
+// file in a format nothing is read from stops after its sniffed bytes.
+// Returns 0, -1 if the file can't be opened or -2 if it can't be read.
+int readWholeFile(const char *fileName, ReadBuffer &buffer);
+
+// Same walk as readImageHeader, over the first length bytes of a file that
+// were read elsewhere. wholeFile says those bytes are the entire file, and
+// exifOffset, if given, gets the file offset of the Exif APP1 marker.
+// Returns false, leaving buffer unspecified, when the EXIF segment may lie
+// beyond the prefix and the caller has to read further.
+bool extractExifSegment(const unsigned char *prefix, size_t length, bool wholeFile,
+                        ReadBuffer &buffer, unsigned long *exifOffset = nullptr);
+
+// Read-only private mapping of a whole image file. The kernel is told the
+// access pattern is random so it does not read ahead through the image data,
+// and the first kInitialHeaderRead bytes are requested up front since that
+// is where the EXIF segment lives. The mapping is released on destruction.
+class MappedImage
+{
+public:
+    MappedImage() : bytes(nullptr), length(0) {}
+    ~MappedImage() { close(); }
+
+    // Returns 0, -1 if the file can't be opened or -2 if it can't be mapped.
+    int open(const char *fileName);
+    void close();
+
+    const unsigned char *data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    unsigned char *bytes;
+    size_t length;
+
+    MappedImage(const MappedImage &);
+    MappedImage &operator=(const MappedImage &);
+};
+
+#endif /* defined(__photo_exif_parsing__image_reader__) */
@@ -0,0 +1,129 @@
+//
+//  jpeg_markers.cpp
+//  photo-exif-parsing
+//
+
+#include "jpeg_markers.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JPEG_MARKERS_X86 1
+#endif
+
+namespace {
+    const unsigned char *findScalar(const unsigned char *from, const unsigned char *end) {
+        const void *found = memchr(from, 0xFF, end - from);
+        return found ? static_cast<const unsigned char *>(found) : end;
+    }
+
+#if JPEG_MARKERS_X86
+    __attribute__((target("sse2")))
+    const unsigned char *findSSE2(const unsigned char *from, const unsigned char *end) {
+        const __m128i ff = _mm_set1_epi8((char)0xFF);
+        for (; end - from >= 16; from += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(from));
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, ff));
+            if (mask) return from + __builtin_ctz(mask);
+        }
+        return findScalar(from, end);
+    }
+
+    __attribute__((target("avx2")))
+    const unsigned char *findAVX2(const unsigned char *from, const unsigned char *end) {
+        const __m256i ff = _mm256_set1_epi8((char)0xFF);
+        for (; end - from >= 32; from += 32) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(from));
+            unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, ff));
+            if (mask) return from + __builtin_ctz(mask);
+        }
+        return findSSE2(from, end);
+    }
+#endif
+
+    typedef const unsigned char *(*FindFunction)(const unsigned char *, const unsigned char *);
+
+    FindFunction pickFind() {
+#if JPEG_MARKERS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return findAVX2;
+        if (__builtin_cpu_supports("sse2")) return findSSE2;
+#endif
+        return findScalar;
+    }
+
+    const FindFunction find = pickFind();
+
+    inline bool isStandalone(unsigned char code) {
+        return code == 0x01 || code == 0xD8 || code == 0xD9 || (code >= 0xD0 && code <= 0xD7);
+    }
+
+    // Offset of the first marker in scan data at or after pos, skipping
+    // stuffed bytes and restarts, or length.
+    size_t skipScanData(const unsigned char *bytes, size_t length, size_t pos) {
+        const unsigned char *end = bytes + length;
+        for (const unsigned char *p = bytes + pos; ; p++) {
+            p = find(p, end);
+            if (end - p < 2) return length;
+            unsigned char code = p[1];
+            if (code != 0x00 && code != 0xFF && !(code >= 0xD0 && code <= 0xD7)) return p - bytes;
+        }
+    }
+}
+
+const unsigned char *findMarkerPrefix(const unsigned char *from, const unsigned char *end) {
+    return find(from, end);
+}
+
+size_t scanJpegMarkers(const unsigned char *bytes, size_t length, size_t start,
+                       bool throughScans, std::vector<JpegMarker> &markers) {
+    size_t pos = start;
+    while (pos < length) {
+        if (bytes[pos] != 0xFF)
+        {
+            // Garbage between segments; resynchronise on the next 0xFF.
+            pos = findMarkerPrefix(bytes + pos, bytes + length) - bytes;
+            continue;
+        }
+        if (pos + 2 > length) break;
+        unsigned char code = bytes[pos + 1];
+        if (code == 0xFF)
+        {
+            // Fill byte before the real marker.
+            pos++;
+            continue;
+        }
+
+        JpegMarker marker;
+        marker.code = code;
+        marker.offset = pos;
+        marker.length = 0;
+        if (!isStandalone(code))
+        {
+            if (pos + 4 > length) break;
+            marker.length = (size_t)bytes[pos + 2] << 8 | bytes[pos + 3];
+            if (marker.length < 2) break;
+        }
+        markers.push_back(marker);
+        pos = marker.end();
+
+        if (code == 0xD9) break;
+        if (code == 0xDA)
+        {
+            if (!throughScans || pos >= length) break;
+            pos = skipScanData(bytes, length, pos);
+        }
+    }
+    return pos;
+}
+
+const JpegMarker *findExifMarker(const std::vector<JpegMarker> &markers,
+                                 const unsigned char *bytes, size_t length) {
+    for (size_t i = 0; i < markers.size(); i++) {
+        const JpegMarker &marker = markers[i];
+        if (marker.code != 0xE1 || marker.length < 8 || marker.end() > length) continue;
+        if (memcmp(bytes + marker.offset + 4, "Exif\0\0", 6) == 0) return &marker;
+    }
+    return nullptr;
+}
@@ -0,0 +1,47 @@
+//
+//  jpeg_markers.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__jpeg_markers__
+#define __photo_exif_parsing__jpeg_markers__
+
+#include <stddef.h>
+#include <vector>
+
+struct JpegMarker
+{
+    unsigned char code;     // the byte after 0xFF, e.g. 0xE1 for APP1
+    size_t offset;          // of the 0xFF, from the start of the scanned bytes
+    size_t length;          // the segment's length field, which counts itself;
+                            // 0 for markers without one (SOI, EOI, RSTn)
+
+    // Where the next marker starts.
+    size_t end() const { return offset + 2 + length; }
+};
+
+// Builds the table of markers in bytes[start, length) in one pass, where
+// start is expected to hold a marker (2 for a whole JPEG, just past SOI).
+// Segments are stepped over by their length fields; stray bytes between
+// segments, and with throughScans the entropy-coded data after SOS, are
+// searched for the next 0xFF sixteen or thirty-two bytes at a time with
+// SSE2 or AVX2, picked at run time, and with memchr elsewhere. Stuffed
+// 0xFF00 bytes and RSTn markers inside scan data are not listed.
+//
+// Scanning ends after SOS unless throughScans is set, at EOI, or when the
+// bytes run out. The return value is where the next marker is expected:
+// just past the last marker listed, which for a segment only partly in
+// bytes lies beyond length, so a caller holding a window of a larger file
+// can resume from there.
+size_t scanJpegMarkers(const unsigned char *bytes, size_t length, size_t start,
+                       bool throughScans, std::vector<JpegMarker> &markers);
+
+// The first APP1 segment carrying Exif data that lies wholly inside
+// bytes[0, length), or nullptr.
+const JpegMarker *findExifMarker(const std::vector<JpegMarker> &markers,
+                                 const unsigned char *bytes, size_t length);
+
+// First 0xFF in [from, end), or end. Exposed for other scanners.
+const unsigned char *findMarkerPrefix(const unsigned char *from, const unsigned char *end);
+
+#endif /* defined(__photo_exif_parsing__jpeg_markers__) */
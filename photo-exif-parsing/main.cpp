@@ -6,239 +6,479 @@
 //  Copyright (c) 2015 Tyler Powers. All rights reserved.
 //
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <iostream>
 #include <algorithm>
-#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
 
-#include "exif.h"
-#include "json.h"
+#include "directory_walker.h"
+#include "metrics.h"
+#include "exif_time.h"
+#include "photo_index.h"
+#include "pipeline.h"
+#include "spatial_index.h"
+#include "staged_ingest.h"
+#include "time_index.h"
+#include "uring_reader.h"
+#include "work_stealing_pool.h"
 
-#include <boost/date_time/local_time/local_time.hpp>
-#include <boost/filesystem.hpp>
+void printHistogram(const std::vector<TimeBucket> &buckets, bool hourly);
+void keepCommonRows(std::vector<RowId> &rows, std::vector<RowId> &other);
 
-using namespace boost::filesystem;
-using namespace boost::gregorian;
-using namespace boost::local_time;
-using namespace boost::posix_time;
-
-struct Photo
+int main(int argc, const char * argv[])
 {
-    std::string identifier;
-    std::string fileName;
+    // -j <threads> sizes the ingest pool; 0 (the default) uses every core.
+    // -r header|mmap|whole|uring picks how parseImage gets at the file's bytes.
+    // -d <dir> is the library root, walked recursively up to --depth levels
+    // and filtered with any number of --include/--exclude globs. Every file
+    // is opened and told apart by its first bytes; files that aren't an
+    // image Exif is read from count as unsupportedFiles in the metrics.
+    // Any number of --ext .jpg limit the walk to those extensions instead,
+    // which saves the open in trees full of other files.
+    // --index <file> moves the incremental index (default: a hidden file in
+    // the library root) and --no-index re-parses everything.
+    // --columnar <file> also writes the binary column store and --json
+    // collects located photos for the time-ordered GeoJSON output;
+    // --json-stream writes it unordered in constant memory instead.
+    // --bbox minLat,minLon,maxLat,maxLon and --near lat,lon,meters limit the
+    // --json output to one map viewport or circle (both: photos inside
+    // both), answered from a spatial index built once ingest is done.
+    // --from/--to "YYYY-MM-DD[ HH:MM:SS]" limit it to a time range in the
+    // same way, and --histogram day|hour prints photo counts per UTC day or
+    // hour of that range.
+    // --metrics <file> moves the per-stage timing report written at exit
+    // and whenever the process gets SIGUSR1.
+    // --json-only skips the CSV and, unless --columnar or --staged is given
+    // too, decodes just the time and GPS fields addPhoto needs; the index
+    // holds whole EXIF records and is not used.
+    // --staged runs ingest as a pipeline of bounded queues that holds at
+    // most --memory-budget <MB> of file data (default 64) however large the
+    // library, with --readers <n> reading and -j threads decoding.
+    // --thumbnails <dir> implies --json-only and copies each written
+    // photo's embedded thumbnail into dir, named after its GeoJSON feature.
+    // --dedupe fingerprints each file's scan data and capture fields on the
+    // decode threads, adds a fingerprint column to the CSV that copies
+    // share, and collapses copies before the GeoJSON is written, listing
+    // them in duplicates.json. The scan data has to be read, so header-only
+    // and -r uring reads become whole-file reads; the index doesn't keep
+    // fingerprints and is not used.
+    unsigned threadCount = 0;
+    ReadMode readMode = READ_HEADER_ONLY;
+    bool batchedReads = false;
+    std::string root = "/Volumes/1TB Ext SSD 1/[iphone pix]";
+    std::string indexPath;
+    std::string columnarPath;
+    std::string thumbnailDir;
+    bool writeGeoJSON = false;
+    bool jsonOnly = false;
+    bool streamGeoJSON = false;
+    bool useIndex = true;
+    double bbox[4];
+    double circle[3];
+    bool filterBox = false;
+    bool filterNear = false;
+    int64_t timeRange[2] = { INT64_MIN, INT64_MAX };
+    bool filterTime = false;
+    bool histogram = false;
+    bool hourlyHistogram = false;
+    std::string metricsPath = "/Users/gr4yscale/code/photo-exif-parsing/metrics.json";
+    bool staged = false;
+    bool dedupe = false;
+    StagedIngestOptions stagedOptions;
+    WalkOptions walkOptions;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threadCount = (unsigned)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            root = argv[++i];
+        }
+        else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc) {
+            indexPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--columnar") == 0 && i + 1 < argc) {
+            columnarPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--json") == 0) {
+            writeGeoJSON = true;
+        }
+        else if (strcmp(argv[i], "--json-only") == 0) {
+            writeGeoJSON = true;
+            jsonOnly = true;
+        }
+        else if (strcmp(argv[i], "--thumbnails") == 0 && i + 1 < argc) {
+            thumbnailDir = argv[++i];
+            writeGeoJSON = true;
+            jsonOnly = true;
+        }
+        else if (strcmp(argv[i], "--json-stream") == 0) {
+            writeGeoJSON = true;
+            streamGeoJSON = true;
+        }
+        else if (strcmp(argv[i], "--bbox") == 0 && i + 1 < argc) {
+            filterBox = sscanf(argv[++i], "%lf,%lf,%lf,%lf", &bbox[0], &bbox[1], &bbox[2], &bbox[3]) == 4;
+            writeGeoJSON = true;
+        }
+        else if (strcmp(argv[i], "--near") == 0 && i + 1 < argc) {
+            filterNear = sscanf(argv[++i], "%lf,%lf,%lf", &circle[0], &circle[1], &circle[2]) == 3;
+            writeGeoJSON = true;
+        }
+        else if ((strcmp(argv[i], "--from") == 0 || strcmp(argv[i], "--to") == 0) && i + 1 < argc) {
+            bool from = strcmp(argv[i], "--from") == 0;
+            std::string value = argv[++i];
+            if (value.size() == 10) value += " 00:00:00";
+            int64_t time = parseExifTimestamp(value.c_str());
+            if (time == kUnknownTime) {
+                printf("Bad time %s, expected YYYY-MM-DD or YYYY-MM-DD HH:MM:SS.\n", argv[i]);
+                return 1;
+            }
+            timeRange[from ? 0 : 1] = time;
+            filterTime = true;
+            writeGeoJSON = true;
+        }
+        else if (strcmp(argv[i], "--histogram") == 0 && i + 1 < argc) {
+            histogram = true;
+            hourlyHistogram = strcmp(argv[++i], "hour") == 0;
+        }
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metricsPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--dedupe") == 0) {
+            dedupe = true;
+        }
+        else if (strcmp(argv[i], "--staged") == 0) {
+            staged = true;
+        }
+        else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+            stagedOptions.memoryBudget = (size_t)strtoull(argv[++i], nullptr, 10) << 20;
+        }
+        else if (strcmp(argv[i], "--readers") == 0 && i + 1 < argc) {
+            stagedOptions.readers = (unsigned)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-index") == 0) {
+            useIndex = false;
+        }
+        else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            walkOptions.maxDepth = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--ext") == 0 && i + 1 < argc) {
+            walkOptions.extensions.push_back(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--include") == 0 && i + 1 < argc) {
+            walkOptions.includeGlobs.push_back(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--exclude") == 0 && i + 1 < argc) {
+            walkOptions.excludeGlobs.push_back(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "mmap") == 0) readMode = READ_MMAP;
+            else if (strcmp(mode, "whole") == 0) readMode = READ_WHOLE_FILE;
+            else if (strcmp(mode, "uring") == 0) batchedReads = true;
+            else readMode = READ_HEADER_ONLY;
+        }
+    }
     
-    double latitude;
-    double longitude;
-    double altitude;
+    // Before any other thread exists, so they all leave SIGUSR1 to the watcher.
+    if (startMetricsSignalWatcher(metricsPath)) {
+        std::cerr << "Can't watch for SIGUSR1; metrics only at exit\n";
+    }
     
-    double time_taken;
-    boost::uintmax_t fileSize;
-};
-
-std::vector<Photo> photos;
-
-int parseImage(const char *fileName, EXIFInfo &result);
-void addPhoto(const char *fileName, EXIFInfo &result);
-void printExifInfo(const char *fileName, EXIFInfo &result);
-void writeJSON();
-void writeCSVLine(std::ofstream &csvFile, EXIFInfo &result, const char *fileName);
-
-int main(int argc, const char * argv[])
-{
-    std::ofstream csv_file ("/Users/gr4yscale/code/photo-exif-parsing/resultsCSV.csv", std::ofstream::out);
-    csv_file << "timeStamp,subsectime,fileName,width,height,size,latitude,longitude,elevation,shutterspeed,iso,aperature,iosver,orientation" << std::endl;
+    bool locationOnly = jsonOnly && columnarPath.empty() && !staged;
+    if (locationOnly) useIndex = false;
     
-    int fileCount = 0;
+    if (dedupe) {
+        if (readMode == READ_HEADER_ONLY) readMode = READ_WHOLE_FILE;
+        batchedReads = false;
+        useIndex = false;
+        if (streamGeoJSON) printf("Streamed GeoJSON can't be deduplicated; copies stay in it.\n");
+    }
     
-    path p = path("/Volumes/1TB Ext SSD 1/[iphone pix]");
-    directory_iterator it{p};
+    // Only the location decode records where thumbnails are.
+    if (!thumbnailDir.empty() && (!locationOnly || streamGeoJSON)) {
+        printf("--thumbnails needs the --json-only path; ignored with --columnar, --staged and --json-stream.\n");
+        thumbnailDir.clear();
+    }
+    if (!thumbnailDir.empty() && mkdir(thumbnailDir.c_str(), 0755) && errno != EEXIST) {
+        printf("Can't create thumbnail directory %s.\n", thumbnailDir.c_str());
+        return 1;
+    }
     
-    while (it != directory_iterator{}) {
-        try
-        {
-            path item = *it;
-            if (item.extension() == ".JPG") {
-                EXIFInfo result;
-                const char *fileName;
-                fileName = item.c_str();
-                int retVal = parseImage(fileName, result);
-                if (!retVal) {
-//                    printExifInfo(fileName, result);
-                    writeCSVLine(csv_file, result, fileName);
-                }
-            }
+    CSVWriter csv_file;
+    if (!jsonOnly) {
+        if (csv_file.open("/Users/gr4yscale/code/photo-exif-parsing/resultsCSV.csv")) {
+            printf("Can't create CSV file.\n");
+            return 1;
         }
-        catch (filesystem_error &e)
-        {
-            std::cerr << e.what() << '\n';
-        }
-        *it++;
-        fileCount++;
-        
-        if (fileCount > 300) break;
+        writeCSVHeader(csv_file, dedupe);
     }
     
-//    writeJSON();
+    ColumnarWriter columnar;
+    if (!columnarPath.empty() && columnar.open(columnarPath.c_str())) {
+        printf("Can't create columnar file.\n");
+        return 1;
+    }
     
-    csv_file.close();
-    return 0;
-}
-
-int parseImage(const char *fileName, EXIFInfo &result) {
-    FILE *fp = fopen(fileName, "rb");
-    if (!fp)
-    {
-        printf("Can't open file.\n");
-        return -1;
-    }
-    fseek(fp, 0, SEEK_END);
-    unsigned long fsize = ftell(fp);
-    rewind(fp);
-    unsigned char *buf = new unsigned char[fsize];
-    if (fread(buf, 1, fsize, fp) != fsize)
-    {
-        printf("Can't read file.\n");
-        delete[] buf;
-        return -2;
+    if (streamGeoJSON && streamedFeatures.open("/Users/gr4yscale/code/photo-exif-parsing/geojson.json")) {
+        printf("Can't create GeoJSON file.\n");
+        return 1;
     }
-    fclose(fp);
     
-    int retval = result.parseFrom(buf, (int)fsize);
-    delete[] buf;
-    if (retval)
-    {
-        printf("Error parsing EXIF: code %d\n", retval);
-        return -3;
+    // The directory walk only produces work; parsing runs on the pool and
+    // the CSV/JSON sinks are serialized by sinkLock.
+    WorkStealingPool pool(threadCount);
+    std::mutex sinkLock;
+    
+    // Files whose (device, inode, size, mtime) match the index from the last
+    // run are answered from it without being opened.
+    PhotoIndex index;
+    if (indexPath.empty()) indexPath = root + "/.photo-exif-index";
+    // Every file gets sniffed now, and the index would be one of them.
+    if (indexPath.compare(0, root.size() + 1, root + "/") == 0) {
+        walkOptions.excludeGlobs.push_back(indexPath.substr(root.size() + 1));
     }
-    return retval;
-}
-
-void writeJSON() {
-    Json::Value root;
-    Json::Value featureCollection;
+    if (useIndex && index.load(indexPath)) {
+        std::cerr << "Ignoring unreadable index " << indexPath << '\n';
+    }
+    
+    // Every successfully parsed photo, fresh or from the index, ends here.
+    auto emitPhoto = [&](const std::string &fileName, EXIFInfo &result, uint64_t fileSize, uint64_t fingerprint) {
+        if (writeGeoJSON || histogram) addPhoto(fileName.c_str(), result, fileSize, fingerprint);
+        std::lock_guard<std::mutex> guard(sinkLock);
+//        printExifInfo(fileName.c_str(), result);
+        if (!jsonOnly) writeCSVLine(csv_file, result, fileName.c_str(), dedupe ? &fingerprint : nullptr);
+        if (!columnarPath.empty()) {
+            writeColumnarRow(columnar, result, fileName.c_str(), fileSize);
+        }
+    };
     
-    featureCollection["type"] = "FeatureCollection";
+    // Runs on a pool thread once a file has been parsed. Parse failures and
+    // unsupported files are remembered as well, but open/read errors may be
+    // transient and are not.
+    auto finishParse = [&](const std::string &fileName, const FileKey *key, EXIFInfo &result, int retVal,
+                           uint64_t fingerprint) {
+        if (useIndex && key && (retVal == 0 || retVal == -3 || retVal == -4)) {
+            index.store(*key, result, retVal);
+        }
+        if (!retVal) {
+            emitPhoto(fileName, result, key ? key->size : 0, fingerprint);
+        }
+    };
     
-    Json::Value features;
+    auto finishLocation = [&](const std::string &fileName, const FileKey *key, const PhotoLocation &location, int retVal,
+                              uint64_t fingerprint) {
+        if (!retVal) addPhoto(fileName.c_str(), location, key ? key->size : 0, fingerprint);
+    };
     
-    std::sort(photos.begin(), photos.end(), [ ](const Photo& a, const Photo& b)
-    {
-        return a.time_taken < b.time_taken;
-    });
+    auto submitParse = [&](const std::string &fileName) {
+        pool.submit([fileName, readMode, locationOnly, dedupe, &finishParse, &finishLocation] {
+            FileKey key;
+            bool haveKey = PhotoIndex::statKey(fileName.c_str(), key);
+            uint64_t fingerprint = 0;
+            if (locationOnly) {
+                PhotoLocation location;
+                int retVal = parseImage(fileName.c_str(), location, readMode, dedupe ? &fingerprint : nullptr);
+                finishLocation(fileName, haveKey ? &key : nullptr, location, retVal, fingerprint);
+                return;
+            }
+            EXIFInfo result;
+            int retVal = parseImage(fileName.c_str(), result, readMode, dedupe ? &fingerprint : nullptr);
+            finishParse(fileName, haveKey ? &key : nullptr, result, retVal, fingerprint);
+        });
+    };
     
-    for (std::vector<Photo>::iterator it=photos.begin(); it!=photos.end(); ++it)
-    {
-        Photo photo = *it;
-        Json::Value geometry;
-        Json::Value properties;
-        Json::Value feature;
-        Json::Value coordinates;
-        
-        coordinates.append(photo.longitude);
-        coordinates.append(photo.latitude);
+    // With -r uring the walk collects files into batches whose headers are
+    // read through io_uring, and each completed read becomes a parse task.
+    // Without kernel support this quietly stays on the blocking path.
+    // --staged does its own reads and ignores it.
+    std::unique_ptr<BatchHeaderReader> batchReader;
+    if (batchedReads && !staged) {
+        batchReader.reset(new BatchHeaderReader());
+        if (!batchReader->available()) {
+            std::cerr << "io_uring unavailable, using blocking reads\n";
+            batchReader.reset();
+        }
+    }
+    const size_t kBatchSize = 4096;
+    std::vector<std::string> pendingBatch;
+    std::mutex batchLock;
+    std::mutex ringLock;
+    
+    // Walker threads hand full batches over here; the ring is single-threaded
+    // so one batch is in the kernel at a time.
+    auto flushBatch = [&](std::vector<std::string> &batch) {
+        if (batch.empty()) return;
+        std::lock_guard<std::mutex> ringGuard(ringLock);
+        std::vector<bool> reported(batch.size(), false);
+        int batchVal = batchReader->readAll(batch, [&](size_t index, ReadBuffer &bytes, bool reachedEnd, int status) {
+            reported[index] = true;
+            std::string fileName = batch[index];
+            std::shared_ptr<ReadBuffer> prefix(new ReadBuffer(std::move(bytes)));
+            pool.submit([fileName, prefix, reachedEnd, status, readMode, locationOnly, &finishParse, &finishLocation] {
+                FileKey key;
+                bool haveKey = PhotoIndex::statKey(fileName.c_str(), key);
+                if (locationOnly) {
+                    PhotoLocation location;
+                    int retVal = status ? parseImage(fileName.c_str(), location, readMode)
+                                        : parseImageHeader(fileName.c_str(), *prefix, reachedEnd, location);
+                    finishLocation(fileName, haveKey ? &key : nullptr, location, retVal, 0);
+                    return;
+                }
+                EXIFInfo result;
+                int retVal = status ? parseImage(fileName.c_str(), result, readMode)
+                                    : parseImageHeader(fileName.c_str(), *prefix, reachedEnd, result);
+                finishParse(fileName, haveKey ? &key : nullptr, result, retVal, 0);
+            });
+        });
+        // Files the ring never reported on are not lost, just read the slow way.
+        if (batchVal) {
+            std::cerr << "io_uring batch failed, retrying with blocking reads\n";
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (reported[i]) continue;
+                submitParse(batch[i]);
+            }
+        }
+        batch.clear();
+    };
+    
+    if (staged) {
+        stagedOptions.decoders = threadCount;
+        stagedOptions.readMode = readMode;
+        stagedOptions.fingerprint = dedupe;
+        StagedLookup lookup;
+        if (useIndex) {
+            lookup = [&](const FileKey &key, EXIFInfo &result, int &status) {
+                return index.lookup(key, result, status);
+            };
+        }
+        // Only the format thread gets here, so nothing needs sinkLock.
+        runStagedIngest(root, walkOptions, stagedOptions, lookup,
+                        [&](const std::string &fileName, const FileKey *key, EXIFInfo &result,
+                            int status, bool lookedUp, uint64_t fingerprint, CSVWriter &rows) {
+            if (useIndex && key && !lookedUp && (status == 0 || status == -3 || status == -4)) {
+                index.store(*key, result, status);
+            }
+            if (status) return;
+            uint64_t fileSize = key ? key->size : 0;
+            if (writeGeoJSON || histogram) addPhoto(fileName.c_str(), result, fileSize, fingerprint);
+            if (!jsonOnly) writeCSVLine(rows, result, fileName.c_str(), dedupe ? &fingerprint : nullptr);
+            if (!columnarPath.empty()) {
+                writeColumnarRow(columnar, result, fileName.c_str(), fileSize);
+            }
+        }, csv_file);
+    }
+    else {
+        walkDirectory(root, walkOptions, [&](const std::string &fileName) {
+            if (useIndex) {
+                FileKey key;
+                EXIFInfo cached;
+                int status;
+                if (PhotoIndex::statKey(fileName.c_str(), key) && index.lookup(key, cached, status)) {
+                    if (!status) emitPhoto(fileName, cached, key.size, 0);
+                    return;
+                }
+            }
+            if (batchReader) {
+                std::vector<std::string> full;
+                {
+                    std::lock_guard<std::mutex> guard(batchLock);
+                    pendingBatch.push_back(fileName);
+                    if (pendingBatch.size() >= kBatchSize) full.swap(pendingBatch);
+                }
+                flushBatch(full);
+                return;
+            }
+            submitParse(fileName);
+        });
         
-        geometry["coordinates"] = coordinates;
-        geometry["type"] = "Point";
+        if (batchReader) flushBatch(pendingBatch);
+    }
+    pool.wait();
+    
+    if (useIndex && index.save(indexPath)) {
+        std::cerr << "Can't write index " << indexPath << '\n';
+    }
+    
+    if (streamGeoJSON) {
+        if (streamedFeatures.close()) printf("Can't write GeoJSON file.\n");
+    }
+    else if (writeGeoJSON || histogram) {
+        // Before any index is built over the row ids.
+        if (dedupe) collapseDuplicates("/Users/gr4yscale/code/photo-exif-parsing/duplicates.json");
+        TimeIndex timeIndex;
+        if (filterTime || histogram) timeIndex.build(photos, &pool);
+        if (histogram) {
+            printHistogram(hourlyHistogram ? timeIndex.hours(timeRange[0], timeRange[1])
+                                           : timeIndex.days(timeRange[0], timeRange[1]), hourlyHistogram);
+        }
         
-        feature["geometry"] = geometry;
-        feature["type"] = "Feature";
-        feature["properties"] = properties;
-        features.append(feature);
+        std::vector<RowId> rows;
+        bool filterPlace = filterBox || filterNear;
+        if (writeGeoJSON && filterPlace) {
+            SpatialIndex spatial;
+            spatial.build(photos, &pool);
+            if (filterBox) spatial.queryBox(bbox[0], bbox[1], bbox[2], bbox[3], rows);
+            if (filterNear) {
+                std::vector<RowId> inCircle;
+                spatial.queryRadius(circle[0], circle[1], circle[2], inCircle);
+                if (filterBox) keepCommonRows(rows, inCircle);
+                else rows.swap(inCircle);
+            }
+        }
+        if (writeGeoJSON && filterTime) {
+            std::vector<RowId> inRange;
+            timeIndex.rowsBetween(timeRange[0], timeRange[1], inRange);
+            if (filterPlace) keepCommonRows(rows, inRange);
+            else rows.swap(inRange);
+        }
+        if (writeGeoJSON) writeJSON("/Users/gr4yscale/code/photo-exif-parsing/geojson.json", &pool,
+                                    filterPlace || filterTime ? &rows : nullptr);
+        if (!thumbnailDir.empty()) exportThumbnails(thumbnailDir.c_str(), &pool,
+                                                    filterPlace || filterTime ? &rows : nullptr);
     }
     
-    featureCollection["features"] = features;
+    stopMetricsSignalWatcher();
+    if (writeMetricsReport(metricsPath)) {
+        std::cerr << "Can't write metrics " << metricsPath << '\n';
+    }
     
-    Json::StyledWriter styledWriter;
-    std::ofstream myfile;
-    myfile.open ("/Users/gr4yscale/code/photo-exif-parsing/geojson.json");
-    myfile << styledWriter.write(featureCollection);
-    myfile.close();
-}
-
-void addPhoto(const char *fileName, EXIFInfo &result) {
-    boost::uintmax_t filesize = file_size(path(fileName));
-    std::string timestamp = result.DateTimeOriginal;
-    
-    local_time_input_facet *input_facet = new local_time_input_facet("%Y-%m-%d %H:%M:%S %ZP");
-    std::stringstream ss;
-    ss.imbue(std::locale(ss.getloc(), input_facet));
-    local_date_time dateTimePhotoTaken(not_a_date_time);
-    ss.str(timestamp);
-    ss >> dateTimePhotoTaken;
-    
-    if (dateTimePhotoTaken.to_string()  == "not-a-date-time") return;
-    
-    time_duration durationSince1970 = dateTimePhotoTaken.utc_time() - (ptime)date(1970,1,1);
-    
-    Photo photo;
-    photo.fileName = fileName;
-    photo.latitude = result.GeoLocation.Latitude;
-    photo.longitude = result.GeoLocation.Longitude;
-    photo.altitude = result.GeoLocation.Altitude;
-    photo.fileSize = filesize;
-    photo.time_taken = durationSince1970.total_seconds();
-    
-    if (photo.latitude > 0 && photo.longitude > 0)
-    {
-        photos.push_back(photo);
+    if (csv_file.close()) {
+        printf("Can't write CSV file.\n");
+        return 1;
+    }
+    if (columnar.close()) {
+        printf("Can't write columnar file.\n");
+        return 1;
     }
+    return 0;
 }
 
-void printExifInfo(const char *fileName, EXIFInfo &result) {
-    printf("Camera make       : %s\n", result.Make.c_str());
-    printf("Camera model      : %s\n", result.Model.c_str());
-    printf("Software          : %s\n", result.Software.c_str());
-    printf("Bits per sample   : %d\n", result.BitsPerSample);
-    printf("Image width       : %d\n", result.ImageWidth);
-    printf("Image height      : %d\n", result.ImageHeight);
-    printf("Image description : %s\n", result.ImageDescription.c_str());
-    printf("Image orientation : %d\n", result.Orientation);
-    printf("Image copyright   : %s\n", result.Copyright.c_str());
-    printf("Image date/time   : %s\n", result.DateTime.c_str());
-    printf("Original date/time: %s\n", result.DateTimeOriginal.c_str());
-    printf("Digitize date/time: %s\n", result.DateTimeDigitized.c_str());
-    printf("Subsecond time    : %s\n", result.SubSecTimeOriginal.c_str());
-    printf("Exposure time     : 1/%d s\n", (unsigned) (1.0/result.ExposureTime));
-    printf("F-stop            : f/%.1f\n", result.FNumber);
-    printf("ISO speed         : %d\n", result.ISOSpeedRatings);
-    printf("Subject distance  : %f m\n", result.SubjectDistance);
-    printf("Exposure bias     : %f EV\n", result.ExposureBiasValue);
-    printf("Flash used?       : %d\n", result.Flash);
-    printf("Metering mode     : %d\n", result.MeteringMode);
-    printf("Lens focal length : %f mm\n", result.FocalLength);
-    printf("35mm focal length : %u mm\n", result.FocalLengthIn35mm);
-    printf("GPS Latitude      : %f deg (%f deg, %f min, %f sec %c)\n",
-           result.GeoLocation.Latitude,
-           result.GeoLocation.LatComponents.degrees,
-           result.GeoLocation.LatComponents.minutes,
-           result.GeoLocation.LatComponents.seconds,
-           result.GeoLocation.LatComponents.direction);
-    printf("GPS Longitude     : %f deg (%f deg, %f min, %f sec %c)\n",
-           result.GeoLocation.Longitude,
-           result.GeoLocation.LonComponents.degrees,
-           result.GeoLocation.LonComponents.minutes,
-           result.GeoLocation.LonComponents.seconds,
-           result.GeoLocation.LonComponents.direction);
-    printf("GPS Altitude      : %f m\n", result.GeoLocation.Altitude);
-    
-    printf("----------------------------------------------------------------\n");
-    
+// Leaves in rows only the ids other has too, in ascending order.
+void keepCommonRows(std::vector<RowId> &rows, std::vector<RowId> &other) {
+    std::vector<RowId> both;
+    std::sort(rows.begin(), rows.end());
+    std::sort(other.begin(), other.end());
+    std::set_intersection(rows.begin(), rows.end(), other.begin(), other.end(), std::back_inserter(both));
+    rows.swap(both);
 }
 
-void writeCSVLine(std::ofstream &csvFile, EXIFInfo &result, const char *fileName) {
-    csvFile << result.DateTimeOriginal.c_str();
-    csvFile << ',' << result.SubSecTimeOriginal.c_str();
-    csvFile << ',' << fileName;
-    csvFile << ',' << result.ImageWidth;
-    csvFile << ',' << result.ImageHeight;
-    csvFile << ',' << "0";
-    csvFile << ',' << result.GeoLocation.Latitude;
-    csvFile << ',' << result.GeoLocation.Longitude;
-    csvFile << ',' << result.GeoLocation.Altitude;
-    csvFile << ",1.0/" << result.ExposureTime;
-    csvFile << ',' << result.ISOSpeedRatings;
-    csvFile << ',' << result.FNumber;
-    csvFile << ',' << result.Software.c_str();
-    csvFile << ',' << result.Orientation;
-    csvFile << std::endl;
+// One "date,count" (or "date hour,count") line per bucket on stdout.
+void printHistogram(const std::vector<TimeBucket> &buckets, bool hourly) {
+    for (std::vector<TimeBucket>::const_iterator it=buckets.begin(); it!=buckets.end(); ++it)
+    {
+        time_t seconds = (time_t)(it->start / 1000000000LL);
+        struct tm fields;
+        gmtime_r(&seconds, &fields);
+        
+        char label[32];
+        strftime(label, sizeof(label), hourly ? "%Y-%m-%d %H:00" : "%Y-%m-%d", &fields);
+        printf("%s,%u\n", label, it->count);
+    }
 }
@@ -0,0 +1,271 @@
+//
+//  metrics.cpp
+//  photo-exif-parsing
+//
+
+#include "metrics.h"
+#include "json.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+
+namespace {
+    // Bucket b > 0 holds latencies in [2^(b-1), 2^b) nanoseconds.
+    const int kBuckets = 64;
+
+    const char *const kStageNames[STAGE_COUNT] = {
+        "open", "read", "decode", "timestamp", "collect", "csv", "json", "hash"
+    };
+    const char *const kCounterNames[COUNTER_COUNT] = {
+        "filesParsed", "bytesRead", "openErrors", "readErrors", "parseErrors",
+        "unsupportedFiles",
+        "noTimestamp", "noLocation", "photosCollected", "csvRows",
+        "bufferHits", "bufferMisses", "duplicates"
+    };
+    const char *const kGaugeNames[GAUGE_COUNT] = {
+        "bufferBytesInUse", "bufferBytesCached"
+    };
+
+    const char *const kQueueNames[QUEUE_COUNT] = {
+        "paths", "reads", "decoded", "rows"
+    };
+
+    struct ThreadMetrics
+    {
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        std::atomic<uint64_t> totals[STAGE_COUNT];
+        std::atomic<uint64_t> buckets[STAGE_COUNT][kBuckets];
+        ThreadMetrics *next;
+    };
+
+    // Every block ever handed out; blocks outlive their threads so nothing
+    // recorded is lost.
+    std::atomic<ThreadMetrics *> allMetrics(nullptr);
+    __thread ThreadMetrics *localMetrics = nullptr;
+
+    ThreadMetrics &metricsForThread() {
+        if (localMetrics) return *localMetrics;
+
+        ThreadMetrics *block = new ThreadMetrics;
+        for (int c = 0; c < COUNTER_COUNT; c++) block->counters[c].store(0);
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            block->totals[s].store(0);
+            for (int b = 0; b < kBuckets; b++) block->buckets[s][b].store(0);
+        }
+        block->next = allMetrics.load();
+        while (!allMetrics.compare_exchange_weak(block->next, block)) {}
+        localMetrics = block;
+        return *block;
+    }
+
+    // Only the owning thread writes, so no read-modify-write is needed.
+    inline void add(std::atomic<uint64_t> &value, uint64_t amount) {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    inline int bucketOf(uint64_t nanos) {
+        return nanos ? std::min(kBuckets - 1, 64 - __builtin_clzll(nanos)) : 0;
+    }
+
+    // Upper edge of the bucket holding the pct-th percentile, in microseconds.
+    double percentileMicros(const uint64_t *buckets, uint64_t count, double pct) {
+        uint64_t rank = (uint64_t)(pct / 100 * count);
+        uint64_t seen = 0;
+        for (int b = 0; b < kBuckets; b++) {
+            seen += buckets[b];
+            if (seen > rank) return (double)(1ULL << b) / 1000;
+        }
+        return 0;
+    }
+
+    // Written under the owning queue's lock; atomics only so the report can
+    // read them from another thread.
+    struct QueueGauge
+    {
+        std::atomic<uint64_t> capacityItems, capacityBytes;
+        std::atomic<uint64_t> items, bytes;
+        std::atomic<uint64_t> peakItems, peakBytes;
+        std::atomic<uint64_t> samples, itemSum;
+        std::atomic<uint64_t> fullNanos, emptyNanos;
+    };
+
+    QueueGauge queueGauges[QUEUE_COUNT];
+
+    // Shared by every thread, unlike the counters.
+    std::atomic<int64_t> gaugeLevels[GAUGE_COUNT];
+    std::atomic<int64_t> gaugePeaks[GAUGE_COUNT];
+
+    pthread_t watcher;
+    bool watching = false;
+    std::atomic<bool> stopWatching(false);
+    std::string watchPath;
+
+    void *watchSignals(void *) {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR1);
+        for (;;) {
+            int signal;
+            if (sigwait(&signals, &signal) != 0) continue;
+            if (stopWatching) break;
+            writeMetricsReport(watchPath);
+        }
+        return nullptr;
+    }
+}
+
+void countMetric(MetricCounter counter, uint64_t amount) {
+    add(metricsForThread().counters[counter], amount);
+}
+
+void recordStage(MetricStage stage, uint64_t nanos) {
+    ThreadMetrics &metrics = metricsForThread();
+    add(metrics.totals[stage], nanos);
+    add(metrics.buckets[stage][bucketOf(nanos)], 1);
+}
+
+void adjustGauge(MetricGauge gauge, int64_t delta) {
+    int64_t value = gaugeLevels[gauge].fetch_add(delta, std::memory_order_relaxed) + delta;
+    int64_t peak = gaugePeaks[gauge].load(std::memory_order_relaxed);
+    while (value > peak && !gaugePeaks[gauge].compare_exchange_weak(peak, value, std::memory_order_relaxed)) {}
+}
+
+void setQueueCapacity(MetricQueue queue, size_t items, size_t bytes) {
+    queueGauges[queue].capacityItems.store(items, std::memory_order_relaxed);
+    queueGauges[queue].capacityBytes.store(bytes, std::memory_order_relaxed);
+}
+
+void recordQueueLevel(MetricQueue queue, size_t items, size_t bytes) {
+    QueueGauge &gauge = queueGauges[queue];
+    gauge.items.store(items, std::memory_order_relaxed);
+    gauge.bytes.store(bytes, std::memory_order_relaxed);
+    if (items > gauge.peakItems.load(std::memory_order_relaxed)) gauge.peakItems.store(items, std::memory_order_relaxed);
+    if (bytes > gauge.peakBytes.load(std::memory_order_relaxed)) gauge.peakBytes.store(bytes, std::memory_order_relaxed);
+    add(gauge.samples, 1);
+    add(gauge.itemSum, items);
+}
+
+void recordQueueWait(MetricQueue queue, bool full, uint64_t nanos) {
+    add(full ? queueGauges[queue].fullNanos : queueGauges[queue].emptyNanos, nanos);
+}
+
+void metricsReport(Json::Value &report) {
+    uint64_t counters[COUNTER_COUNT] = { 0 };
+    uint64_t totals[STAGE_COUNT] = { 0 };
+    uint64_t buckets[STAGE_COUNT][kBuckets] = { { 0 } };
+    for (ThreadMetrics *block = allMetrics.load(); block; block = block->next) {
+        for (int c = 0; c < COUNTER_COUNT; c++) counters[c] += block->counters[c].load(std::memory_order_relaxed);
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            totals[s] += block->totals[s].load(std::memory_order_relaxed);
+            for (int b = 0; b < kBuckets; b++) buckets[s][b] += block->buckets[s][b].load(std::memory_order_relaxed);
+        }
+    }
+
+    Json::Value counterValues(Json::objectValue);
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        counterValues[kCounterNames[c]] = (Json::UInt64)counters[c];
+    }
+
+    Json::Value stageValues(Json::objectValue);
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        uint64_t count = 0;
+        Json::Value histogram(Json::arrayValue);
+        for (int b = 0; b < kBuckets; b++) {
+            if (!buckets[s][b]) continue;
+            count += buckets[s][b];
+            Json::Value bucket(Json::arrayValue);
+            bucket.append((double)(1ULL << b) / 1000);
+            bucket.append((Json::UInt64)buckets[s][b]);
+            histogram.append(bucket);
+        }
+
+        Json::Value stage(Json::objectValue);
+        stage["count"] = (Json::UInt64)count;
+        stage["totalMicros"] = totals[s] / 1000.0;
+        stage["meanMicros"] = count ? totals[s] / 1000.0 / count : 0.0;
+        stage["p50Micros"] = percentileMicros(buckets[s], count, 50);
+        stage["p99Micros"] = percentileMicros(buckets[s], count, 99);
+        // [upper edge in microseconds, count] per non-empty bucket.
+        stage["histogram"] = histogram;
+        stageValues[kStageNames[s]] = stage;
+    }
+
+    Json::Value gaugeValues(Json::objectValue);
+    for (int g = 0; g < GAUGE_COUNT; g++) {
+        Json::Value gauge(Json::objectValue);
+        gauge["current"] = (Json::Int64)gaugeLevels[g].load(std::memory_order_relaxed);
+        gauge["peak"] = (Json::Int64)gaugePeaks[g].load(std::memory_order_relaxed);
+        gaugeValues[kGaugeNames[g]] = gauge;
+    }
+    uint64_t bufferRequests = counters[COUNT_BUFFER_HITS] + counters[COUNT_BUFFER_MISSES];
+
+    // A stage whose input queue sits near capacity while its output queue
+    // runs empty is the bottleneck.
+    Json::Value queueValues(Json::objectValue);
+    for (int q = 0; q < QUEUE_COUNT; q++) {
+        const QueueGauge &gauge = queueGauges[q];
+        uint64_t samples = gauge.samples.load(std::memory_order_relaxed);
+        if (!samples) continue;
+
+        Json::Value values(Json::objectValue);
+        values["capacityItems"] = (Json::UInt64)gauge.capacityItems.load(std::memory_order_relaxed);
+        values["capacityBytes"] = (Json::UInt64)gauge.capacityBytes.load(std::memory_order_relaxed);
+        values["items"] = (Json::UInt64)gauge.items.load(std::memory_order_relaxed);
+        values["bytes"] = (Json::UInt64)gauge.bytes.load(std::memory_order_relaxed);
+        values["meanItems"] = (double)gauge.itemSum.load(std::memory_order_relaxed) / samples;
+        values["peakItems"] = (Json::UInt64)gauge.peakItems.load(std::memory_order_relaxed);
+        values["peakBytes"] = (Json::UInt64)gauge.peakBytes.load(std::memory_order_relaxed);
+        values["producerBlockedMicros"] = gauge.fullNanos.load(std::memory_order_relaxed) / 1000.0;
+        values["consumerBlockedMicros"] = gauge.emptyNanos.load(std::memory_order_relaxed) / 1000.0;
+        queueValues[kQueueNames[q]] = values;
+    }
+
+    report["counters"] = counterValues;
+    report["stages"] = stageValues;
+    report["gauges"] = gaugeValues;
+    report["bufferHitRate"] = bufferRequests ? (double)counters[COUNT_BUFFER_HITS] / bufferRequests : 0.0;
+    report["queues"] = queueValues;
+}
+
+int writeMetricsReport(const std::string &path) {
+    Json::Value report;
+    metricsReport(report);
+    Json::StyledWriter styledWriter;
+    std::string text = styledWriter.write(report);
+
+    if (path.empty())
+    {
+        fputs(text.c_str(), stderr);
+        return 0;
+    }
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp) return -1;
+    bool failed = fwrite(text.data(), 1, text.size(), fp) != text.size();
+    if (fclose(fp) != 0) failed = true;
+    return failed ? -1 : 0;
+}
+
+int startMetricsSignalWatcher(const std::string &path) {
+    if (watching) return 0;
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &signals, nullptr) != 0) return -1;
+
+    watchPath = path;
+    stopWatching = false;
+    if (pthread_create(&watcher, nullptr, watchSignals, nullptr) != 0) return -1;
+    watching = true;
+    return 0;
+}
+
+void stopMetricsSignalWatcher() {
+    if (!watching) return;
+    stopWatching = true;
+    pthread_kill(watcher, SIGUSR1);
+    pthread_join(watcher, nullptr);
+    watching = false;
+}
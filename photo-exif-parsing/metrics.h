@@ -0,0 +1,126 @@
+//
+//  metrics.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__metrics__
+#define __photo_exif_parsing__metrics__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+
+namespace Json { class Value; }
+
+// Timed steps of an ingest run.
+enum MetricStage
+{
+    STAGE_OPEN,         // open()/fopen()/mmap() of an image
+    STAGE_READ,         // reading the header or the whole file
+    STAGE_DECODE,       // EXIFInfo::parseFrom
+    STAGE_TIMESTAMP,    // DateTimeOriginal to epoch nanoseconds
+    STAGE_COLLECT,      // appending to the table or the GeoJSON stream
+    STAGE_CSV,          // writeCSVLine
+    STAGE_JSON,         // writeJSON, once per run
+    STAGE_HASH,         // content fingerprint of a whole file
+    STAGE_COUNT
+};
+
+enum MetricCounter
+{
+    COUNT_FILES_PARSED,
+    COUNT_BYTES_READ,
+    COUNT_OPEN_ERRORS,
+    COUNT_READ_ERRORS,
+    COUNT_PARSE_ERRORS,
+    COUNT_UNSUPPORTED_FILES,    // not in a format Exif is read from
+    COUNT_NO_TIMESTAMP,
+    COUNT_NO_LOCATION,
+    COUNT_PHOTOS_COLLECTED,
+    COUNT_CSV_ROWS,
+    COUNT_BUFFER_HITS,          // read buffers reused from the pool
+    COUNT_BUFFER_MISSES,        // read buffers newly allocated
+    COUNT_DUPLICATES,           // photos collapsed into an earlier copy
+    COUNTER_COUNT
+};
+
+// Hand-off queues of the staged pipeline, named after what they carry.
+enum MetricQueue
+{
+    QUEUE_PATHS,        // enumerate -> read
+    QUEUE_READS,        // read -> decode, file bytes
+    QUEUE_DECODED,      // decode -> format
+    QUEUE_ROWS,         // format -> write, CSV text
+    QUEUE_COUNT
+};
+
+// Each thread gets its own block of counters and log2 latency histograms
+// on first use, so recording is a relaxed load and store on memory no
+// other thread writes. Readers sum every block without locking and may see
+// a recording half done; totals settle once the threads go quiet.
+
+void countMetric(MetricCounter counter, uint64_t amount = 1);
+void recordStage(MetricStage stage, uint64_t nanos);
+
+// Levels that go up and down; the report shows the current value and the
+// highest seen.
+enum MetricGauge
+{
+    GAUGE_BUFFER_BYTES_IN_USE,  // held by live ReadBuffers
+    GAUGE_BUFFER_BYTES_CACHED,  // free in the buffer pool
+    GAUGE_COUNT
+};
+
+void adjustGauge(MetricGauge gauge, int64_t delta);
+
+// Queue gauges are shared by every thread and updated with the queue's own
+// lock held. setQueueCapacity is called once when the queue is made;
+// recordQueueLevel after every push and pop; recordQueueWait whenever a
+// producer blocked on a full queue or a consumer on an empty one.
+void setQueueCapacity(MetricQueue queue, size_t items, size_t bytes);
+void recordQueueLevel(MetricQueue queue, size_t items, size_t bytes);
+void recordQueueWait(MetricQueue queue, bool full, uint64_t nanos);
+
+// Times consecutive stages with one clock read per boundary:
+//
+//     StageClock clock;
+//     open(...);    clock.lap(STAGE_OPEN);
+//     read(...);    clock.lap(STAGE_READ);
+class StageClock
+{
+public:
+    StageClock() : last(std::chrono::steady_clock::now()) {}
+
+    void lap(MetricStage stage) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        recordStage(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count());
+        last = now;
+    }
+
+    // Starts the next stage now without recording the time since the last.
+    void restart() { last = std::chrono::steady_clock::now(); }
+
+private:
+    std::chrono::steady_clock::time_point last;
+};
+
+// Counters and, per stage, count, total, mean, estimated p50/p99 and the
+// non-empty histogram buckets, all times in microseconds. Gauges, and the
+// buffer pool's hit rate. Queues that were
+// used report capacity, current, mean and peak occupancy and how long
+// producers and consumers spent blocked on them.
+void metricsReport(Json::Value &report);
+
+// Writes metricsReport through Json::StyledWriter to path, or to stderr
+// when path is empty. Returns 0 or -1 if the file can't be written.
+int writeMetricsReport(const std::string &path);
+
+// Writes the report to path each time the process gets SIGUSR1, from a
+// watcher thread rather than the handler. Call before starting any other
+// thread so they all inherit the blocked signal. Not available on every
+// platform; returns -1 when the watcher can't be started.
+int startMetricsSignalWatcher(const std::string &path);
+void stopMetricsSignalWatcher();
+
+#endif /* defined(__photo_exif_parsing__metrics__) */
@@ -0,0 +1,246 @@
+//
+//  photo_index.cpp
+//  photo-exif-parsing
+//
+
+#include "photo_index.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vector>
+
+namespace {
+    const char kIndexMagic[8] = { 'P', 'X', 'I', 'D', 'X', 0, 0, 0 };
+    const uint32_t kIndexVersion = 2;
+
+    // Smallest serialised entry: the file key, status, five empty strings
+    // and the fixed-width fields. Bounds the declared count before reserving.
+    const size_t kMinimumEntrySize = 4 * sizeof(uint64_t) + sizeof(int32_t) + 5 * sizeof(uint32_t)
+        + 2 * sizeof(uint32_t) + 2 * sizeof(uint16_t) + 5 * sizeof(double);
+
+    template <typename T>
+    void put(std::vector<char> &out, const T &value) {
+        const char *bytes = reinterpret_cast<const char *>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    void putString(std::vector<char> &out, const std::string &value) {
+        put(out, (uint32_t)value.size());
+        out.insert(out.end(), value.begin(), value.end());
+    }
+
+    // Bounds-checked cursor over the loaded file.
+    class Reader
+    {
+    public:
+        Reader(const std::vector<char> &data) : data(data), pos(0), ok(true) {}
+
+        template <typename T>
+        T get() {
+            T value = T();
+            if (pos + sizeof(T) > data.size())
+            {
+                ok = false;
+                return value;
+            }
+            memcpy(&value, &data[pos], sizeof(T));
+            pos += sizeof(T);
+            return value;
+        }
+
+        std::string getString() {
+            uint32_t length = get<uint32_t>();
+            if (!ok || pos + length > data.size())
+            {
+                ok = false;
+                return std::string();
+            }
+            std::string value(&data[pos], length);
+            pos += length;
+            return value;
+        }
+
+        bool good() const { return ok; }
+        size_t remaining() const { return data.size() - pos; }
+
+    private:
+        const std::vector<char> &data;
+        size_t pos;
+        bool ok;
+    };
+}
+
+bool PhotoIndex::statKey(const char *fileName, FileKey &key) {
+    struct stat st;
+    if (stat(fileName, &st) != 0) return false;
+    key.device = (uint64_t)st.st_dev;
+    key.inode = (uint64_t)st.st_ino;
+    key.size = (uint64_t)st.st_size;
+#if defined(__APPLE__)
+    key.mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    key.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+int PhotoIndex::load(const std::string &fileName) {
+    std::lock_guard<std::mutex> guard(lock);
+    entries.clear();
+
+    FILE *fp = fopen(fileName.c_str(), "rb");
+    if (!fp) return 0;
+    fseek(fp, 0, SEEK_END);
+    long fsize = ftell(fp);
+    rewind(fp);
+    std::vector<char> data(fsize > 0 ? (size_t)fsize : 0);
+    bool readOk = data.empty() || fread(&data[0], 1, data.size(), fp) == data.size();
+    fclose(fp);
+    if (!readOk || data.size() < sizeof(kIndexMagic) || memcmp(&data[0], kIndexMagic, sizeof(kIndexMagic)) != 0)
+    {
+        return -1;
+    }
+
+    Reader reader(data);
+    for (size_t i = 0; i < sizeof(kIndexMagic); i++) reader.get<char>();
+    if (reader.get<uint32_t>() != kIndexVersion) return -1;
+    uint64_t count = reader.get<uint64_t>();
+    if (!reader.good() || count > reader.remaining() / kMinimumEntrySize) return -1;
+
+    entries.reserve((size_t)count);
+    for (uint64_t i = 0; i < count && reader.good(); i++) {
+        FileKey key;
+        key.device = reader.get<uint64_t>();
+        key.inode = reader.get<uint64_t>();
+        key.size = reader.get<uint64_t>();
+        key.mtime = reader.get<int64_t>();
+
+        Entry entry;
+        entry.seen = false;
+        entry.status = reader.get<int32_t>();
+        entry.DateTimeOriginal = reader.getString();
+        entry.SubSecTimeOriginal = reader.getString();
+        entry.Software = reader.getString();
+        entry.Make = reader.getString();
+        entry.Model = reader.getString();
+        entry.ImageWidth = reader.get<uint32_t>();
+        entry.ImageHeight = reader.get<uint32_t>();
+        entry.ISOSpeedRatings = reader.get<uint16_t>();
+        entry.Orientation = reader.get<uint16_t>();
+        entry.ExposureTime = reader.get<double>();
+        entry.FNumber = reader.get<double>();
+        entry.Latitude = reader.get<double>();
+        entry.Longitude = reader.get<double>();
+        entry.Altitude = reader.get<double>();
+        if (reader.good()) entries[key] = entry;
+    }
+    if (!reader.good())
+    {
+        entries.clear();
+        return -1;
+    }
+    return 0;
+}
+
+int PhotoIndex::save(const std::string &fileName) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    uint64_t count = 0;
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->second.seen) count++;
+    }
+
+    std::vector<char> out;
+    out.insert(out.end(), kIndexMagic, kIndexMagic + sizeof(kIndexMagic));
+    put(out, kIndexVersion);
+    put(out, count);
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        const Entry &entry = it->second;
+        if (!entry.seen) continue;
+        put(out, it->first.device);
+        put(out, it->first.inode);
+        put(out, it->first.size);
+        put(out, it->first.mtime);
+        put(out, entry.status);
+        putString(out, entry.DateTimeOriginal);
+        putString(out, entry.SubSecTimeOriginal);
+        putString(out, entry.Software);
+        putString(out, entry.Make);
+        putString(out, entry.Model);
+        put(out, entry.ImageWidth);
+        put(out, entry.ImageHeight);
+        put(out, entry.ISOSpeedRatings);
+        put(out, entry.Orientation);
+        put(out, entry.ExposureTime);
+        put(out, entry.FNumber);
+        put(out, entry.Latitude);
+        put(out, entry.Longitude);
+        put(out, entry.Altitude);
+    }
+
+    std::string tempName = fileName + ".tmp";
+    FILE *fp = fopen(tempName.c_str(), "wb");
+    if (!fp) return -1;
+    bool written = fwrite(out.data(), 1, out.size(), fp) == out.size();
+    if (fclose(fp) != 0) written = false;
+    if (!written || rename(tempName.c_str(), fileName.c_str()) != 0)
+    {
+        remove(tempName.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+bool PhotoIndex::lookup(const FileKey &key, EXIFInfo &result, int &status) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = entries.find(key);
+    if (it == entries.end())
+    {
+        misses++;
+        return false;
+    }
+    hits++;
+
+    Entry &entry = it->second;
+    entry.seen = true;
+    status = entry.status;
+    result.DateTimeOriginal = entry.DateTimeOriginal;
+    result.SubSecTimeOriginal = entry.SubSecTimeOriginal;
+    result.Software = entry.Software;
+    result.Make = entry.Make;
+    result.Model = entry.Model;
+    result.ImageWidth = entry.ImageWidth;
+    result.ImageHeight = entry.ImageHeight;
+    result.ISOSpeedRatings = entry.ISOSpeedRatings;
+    result.Orientation = entry.Orientation;
+    result.ExposureTime = entry.ExposureTime;
+    result.FNumber = entry.FNumber;
+    result.GeoLocation.Latitude = entry.Latitude;
+    result.GeoLocation.Longitude = entry.Longitude;
+    result.GeoLocation.Altitude = entry.Altitude;
+    return true;
+}
+
+void PhotoIndex::store(const FileKey &key, const EXIFInfo &result, int status) {
+    Entry entry;
+    entry.seen = true;
+    entry.status = status;
+    entry.DateTimeOriginal = result.DateTimeOriginal;
+    entry.SubSecTimeOriginal = result.SubSecTimeOriginal;
+    entry.Software = result.Software;
+    entry.Make = result.Make;
+    entry.Model = result.Model;
+    entry.ImageWidth = result.ImageWidth;
+    entry.ImageHeight = result.ImageHeight;
+    entry.ISOSpeedRatings = result.ISOSpeedRatings;
+    entry.Orientation = result.Orientation;
+    entry.ExposureTime = result.ExposureTime;
+    entry.FNumber = result.FNumber;
+    entry.Latitude = result.GeoLocation.Latitude;
+    entry.Longitude = result.GeoLocation.Longitude;
+    entry.Altitude = result.GeoLocation.Altitude;
+
+    std::lock_guard<std::mutex> guard(lock);
+    entries[key] = entry;
+}
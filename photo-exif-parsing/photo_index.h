@@ -0,0 +1,103 @@
+//
+//  photo_index.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__photo_index__
+#define __photo_exif_parsing__photo_index__
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "exif.h"
+
+// Identity of a file's contents as far as the index is concerned. A file
+// whose key is unchanged since the last run is assumed to hold the same
+// EXIF data and is not opened again.
+struct FileKey
+{
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;      // nanoseconds since the epoch
+
+    bool operator==(const FileKey &other) const {
+        return device == other.device && inode == other.inode &&
+               size == other.size && mtime == other.mtime;
+    }
+};
+
+struct FileKeyHash
+{
+    size_t operator()(const FileKey &key) const {
+        uint64_t h = key.inode * 0x9E3779B97F4A7C15ULL;
+        h ^= key.device + 0x632BE59BD9B4E019ULL + (h << 6) + (h >> 2);
+        h ^= key.size + 0x632BE59BD9B4E019ULL + (h << 6) + (h >> 2);
+        h ^= (uint64_t)key.mtime + 0x632BE59BD9B4E019ULL + (h << 6) + (h >> 2);
+        return (size_t)h;
+    }
+};
+
+// On-disk cache of the EXIF fields the CSV, columnar and JSON outputs use,
+// keyed by FileKey. Entries also remember files that failed to parse so
+// those are not retried on every run. Lookups and stores may come from any
+// thread.
+//
+// The file is a local cache in native byte order; anything it can't read
+// back (wrong magic, old version, truncation) is treated as an empty index.
+class PhotoIndex
+{
+public:
+    PhotoIndex() : hits(0), misses(0) {}
+
+    // Returns 0 on success or when the file doesn't exist yet, -1 when it
+    // exists but can't be used (the index then starts out empty).
+    int load(const std::string &fileName);
+
+    // Writes only the entries looked up or stored since load(), so files
+    // that disappeared from the library drop out. Writes to a temporary
+    // file and renames it over fileName. Returns 0 or -1.
+    int save(const std::string &fileName);
+
+    // stat()s fileName into key. Returns false if it can't be stat'ed.
+    static bool statKey(const char *fileName, FileKey &key);
+
+    // Fills result and status (parseImage's return value) from the entry
+    // for key, if there is one.
+    bool lookup(const FileKey &key, EXIFInfo &result, int &status);
+    void store(const FileKey &key, const EXIFInfo &result, int status);
+
+    size_t hitCount() const { return hits; }
+    size_t missCount() const { return misses; }
+
+private:
+    struct Entry
+    {
+        int32_t status;
+        bool seen;
+
+        std::string DateTimeOriginal;
+        std::string SubSecTimeOriginal;
+        std::string Software;
+        std::string Make;
+        std::string Model;
+        uint32_t ImageWidth;
+        uint32_t ImageHeight;
+        uint16_t ISOSpeedRatings;
+        uint16_t Orientation;
+        double ExposureTime;
+        double FNumber;
+        double Latitude;
+        double Longitude;
+        double Altitude;
+    };
+
+    std::unordered_map<FileKey, Entry, FileKeyHash> entries;
+    std::mutex lock;
+    size_t hits;
+    size_t misses;
+};
+
+#endif /* defined(__photo_exif_parsing__photo_index__) */
@@ -0,0 +1,113 @@
+//
+//  photo_table.cpp
+//  photo-exif-parsing
+//
+
+#include "photo_table.h"
+#include "radix_sort.h"
+
+#include <string.h>
+#include <algorithm>
+
+RowId PhotoTable::append(const char *fileName, double latitude, double longitude,
+                         double altitude, int64_t timeTaken, uint64_t fileSize,
+                         uint64_t thumbnailOffset, uint32_t thumbnailLength,
+                         uint64_t fingerprint) {
+    if (nameOffsets.empty()) nameOffsets.push_back(0);
+
+    RowId row = (RowId)size();
+    this->latitude.push_back(latitude);
+    this->longitude.push_back(longitude);
+    this->altitude.push_back(altitude);
+    this->timeTaken.push_back(timeTaken);
+    this->fileSize.push_back(fileSize);
+    this->thumbnailOffset.push_back(thumbnailOffset);
+    this->thumbnailLength.push_back(thumbnailLength);
+    this->fingerprint.push_back(fingerprint);
+
+    names.insert(names.end(), fileName, fileName + strlen(fileName) + 1);
+    nameOffsets.push_back(names.size());
+    return row;
+}
+
+void PhotoTable::reserve(size_t rows, size_t fileNameBytes) {
+    latitude.reserve(rows);
+    longitude.reserve(rows);
+    altitude.reserve(rows);
+    timeTaken.reserve(rows);
+    fileSize.reserve(rows);
+    thumbnailOffset.reserve(rows);
+    thumbnailLength.reserve(rows);
+    fingerprint.reserve(rows);
+    nameOffsets.reserve(rows + 1);
+    names.reserve(fileNameBytes);
+}
+
+void PhotoTable::clear() {
+    latitude.clear();
+    longitude.clear();
+    altitude.clear();
+    timeTaken.clear();
+    fileSize.clear();
+    thumbnailOffset.clear();
+    thumbnailLength.clear();
+    fingerprint.clear();
+    names.clear();
+    nameOffsets.clear();
+}
+
+namespace {
+    template <typename T>
+    void gather(std::vector<T> &column, const std::vector<RowId> &rows) {
+        // rows is ascending, so every write lands at or before its read.
+        for (size_t i = 0; i < rows.size(); i++) column[i] = column[rows[i]];
+        column.resize(rows.size());
+    }
+}
+
+void PhotoTable::keepRows(const std::vector<RowId> &rows) {
+    gather(latitude, rows);
+    gather(longitude, rows);
+    gather(altitude, rows);
+    gather(timeTaken, rows);
+    gather(fileSize, rows);
+    gather(thumbnailOffset, rows);
+    gather(thumbnailLength, rows);
+    gather(fingerprint, rows);
+
+    std::vector<char> keptNames;
+    std::vector<size_t> keptOffsets(1, 0);
+    keptOffsets.reserve(rows.size() + 1);
+    for (size_t i = 0; i < rows.size(); i++) {
+        const char *name = fileName(rows[i]);
+        keptNames.insert(keptNames.end(), name, name + fileNameLength(rows[i]) + 1);
+        keptOffsets.push_back(keptNames.size());
+    }
+    names.swap(keptNames);
+    nameOffsets.swap(keptOffsets);
+}
+
+std::vector<RowId> PhotoTable::sortedByTime(WorkStealingPool *pool) const {
+    std::vector<uint64_t> keys(size());
+    for (size_t i = 0; i < keys.size(); i++) keys[i] = radixKey(timeTaken[i]);
+
+    std::vector<RowId> order;
+    radixSortOrder(keys.empty() ? nullptr : &keys[0], keys.size(), order, pool);
+
+    // Burst shots can share a timestamp down to the sub-second digits;
+    // order those short runs by file name.
+    for (size_t start = 0; start < order.size(); ) {
+        size_t end = start + 1;
+        while (end < order.size() && keys[order[end]] == keys[order[start]]) end++;
+        if (end - start > 1)
+        {
+            std::sort(order.begin() + start, order.begin() + end, [this](RowId a, RowId b)
+            {
+                int byName = strcmp(fileName(a), fileName(b));
+                return byName != 0 ? byName < 0 : a < b;
+            });
+        }
+        start = end;
+    }
+    return order;
+}
@@ -0,0 +1,83 @@
+//
+//  photo_table.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__photo_table__
+#define __photo_exif_parsing__photo_table__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class WorkStealingPool;
+
+// Row ids are handed out in append order and only change in keepRows;
+// sorting and filtering produce lists of row ids instead of moving rows
+// around.
+typedef uint32_t RowId;
+
+// Structure-of-arrays store for ingested photos. Every field lives in its
+// own contiguous column and file names are packed into one arena, so a sort
+// by time or a bounding-box scan only pulls the columns it compares through
+// the cache.
+//
+// Not thread-safe; callers serialize appends.
+class PhotoTable
+{
+public:
+    RowId append(const char *fileName, double latitude, double longitude,
+                 double altitude, int64_t timeTaken, uint64_t fileSize,
+                 uint64_t thumbnailOffset = 0, uint32_t thumbnailLength = 0,
+                 uint64_t fingerprint = 0);
+    void reserve(size_t rows, size_t fileNameBytes = 0);
+    void clear();
+
+    // Drops every row not in rows, which must be ascending, and renumbers
+    // the rest 0, 1, ... in their old order. Row ids taken earlier, and
+    // indexes built over them, are stale afterwards.
+    void keepRows(const std::vector<RowId> &rows);
+
+    size_t size() const { return timeTaken.size(); }
+    bool empty() const { return timeTaken.empty(); }
+
+    const std::vector<double> &latitudes() const { return latitude; }
+    const std::vector<double> &longitudes() const { return longitude; }
+    const std::vector<double> &altitudes() const { return altitude; }
+    // Capture times in nanoseconds since the epoch.
+    const std::vector<int64_t> &timesTaken() const { return timeTaken; }
+    const std::vector<uint64_t> &fileSizes() const { return fileSize; }
+    // Where in the file the embedded JPEG thumbnail lies; length 0 when
+    // there is none or it wasn't looked for.
+    const std::vector<uint64_t> &thumbnailOffsets() const { return thumbnailOffset; }
+    const std::vector<uint32_t> &thumbnailLengths() const { return thumbnailLength; }
+    // Content fingerprint from hashScanData and the capture fields; 0 when
+    // none was taken.
+    const std::vector<uint64_t> &fingerprints() const { return fingerprint; }
+
+    // Points into the arena; valid until the next append.
+    const char *fileName(RowId row) const { return &names[nameOffsets[row]]; }
+    size_t fileNameLength(RowId row) const { return nameOffsets[row + 1] - nameOffsets[row] - 1; }
+
+    // Every row id, ordered by capture time (sub-second digits included),
+    // with equal times ordered by file name. Radix sorts the time column,
+    // spread over pool when one is given; the pool must be idle.
+    std::vector<RowId> sortedByTime(WorkStealingPool *pool = nullptr) const;
+
+private:
+    std::vector<double> latitude;
+    std::vector<double> longitude;
+    std::vector<double> altitude;
+    std::vector<int64_t> timeTaken;
+    std::vector<uint64_t> fileSize;
+    std::vector<uint64_t> thumbnailOffset;
+    std::vector<uint32_t> thumbnailLength;
+    std::vector<uint64_t> fingerprint;
+
+    // File names, NUL-terminated back to back; row r spans
+    // [nameOffsets[r], nameOffsets[r + 1]).
+    std::vector<char> names;
+    std::vector<size_t> nameOffsets;
+};
+
+#endif /* defined(__photo_exif_parsing__photo_table__) */
@@ -0,0 +1,534 @@
+//
+//  pipeline.cpp
+//  photo-exif-parsing
+//
+
+#include "pipeline.h"
+#include "exif_time.h"
+#include "fingerprint.h"
+#include "image_format.h"
+#include "jpeg_markers.h"
+#include "metrics.h"
+#include "work_stealing_pool.h"
+#include "json.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+PhotoTable photos;
+std::mutex photosLock;
+GeoJSONWriter streamedFeatures;
+
+// Counts the outcome of a parse and passes its status through.
+static int countParse(int status) {
+    if (status == -1) countMetric(COUNT_OPEN_ERRORS);
+    else if (status == -2) countMetric(COUNT_READ_ERRORS);
+    else if (status == -3) countMetric(COUNT_PARSE_ERRORS);
+    else if (status == -4) countMetric(COUNT_UNSUPPORTED_FILES);
+    else countMetric(COUNT_FILES_PARSED);
+    return status;
+}
+
+static int decode(EXIFInfo &result, const unsigned char *bytes, size_t length) {
+    StageClock clock;
+    // parseFrom would look for APP1 a byte at a time; the marker table
+    // finds it by segment and the TIFF block goes straight to the parser.
+    int retval = -1;
+    if (length >= 4 && bytes[0] == 0xFF && bytes[1] == 0xD8)
+    {
+        std::vector<JpegMarker> markers;
+        scanJpegMarkers(bytes, length, 2, false, markers);
+        const JpegMarker *exif = findExifMarker(markers, bytes, length);
+        if (exif) retval = result.parseFromEXIFSegment(bytes + exif->offset + 4, (unsigned)exif->length - 2);
+    }
+    clock.lap(STAGE_DECODE);
+    return countParse(retval ? -3 : 0);
+}
+
+static int decode(PhotoLocation &result, const unsigned char *bytes, size_t length) {
+    StageClock clock;
+    int retval = decodeExif(bytes, length, result);
+    clock.lap(STAGE_DECODE);
+    return countParse(retval);
+}
+
+// Decoded bytes that don't map onto the file in one piece.
+const uint64_t kUnplaced = UINT64_MAX;
+
+// readImageHeader and extractExifSegment put SOI in front of the APP1
+// segment they copy out.
+static uint64_t headerBufferStart(unsigned long exifOffset) {
+    return exifOffset >= 2 ? exifOffset - 2 : kUnplaced;
+}
+
+// Turns a thumbnail span within the decoded bytes into one within the file,
+// given where those bytes start in it.
+static void placeThumbnail(EXIFInfo &, uint64_t) {}
+
+static void placeThumbnail(PhotoLocation &result, uint64_t bufferStart) {
+    if (bufferStart == kUnplaced) result.thumbnailLength = 0;
+    if (result.thumbnailLength) result.thumbnailOffset += bufferStart;
+}
+
+// 16 hex digits, or empty for "no fingerprint"; text holds 17 bytes.
+static void formatFingerprint(char *text, uint64_t fingerprint) {
+    if (fingerprint) snprintf(text, 17, "%016llx", (unsigned long long)fingerprint);
+    else text[0] = '\0';
+}
+
+// The capture fields two copies of a photo share even when one was
+// re-exported, folded into the scan data hash.
+static uint64_t hashCapture(uint64_t hash, const char *dateTime, const char *subSec,
+                            double latitude, double longitude) {
+    hash = hashBytes(dateTime, strlen(dateTime), hash);
+    hash = hashBytes(subSec, strlen(subSec), hash);
+    hash = hashBytes(&latitude, sizeof(latitude), hash);
+    return hashBytes(&longitude, sizeof(longitude), hash);
+}
+
+static uint64_t hashCapture(uint64_t hash, EXIFInfo &result) {
+    return hashCapture(hash, result.DateTimeOriginal.c_str(), result.SubSecTimeOriginal.c_str(),
+                       result.GeoLocation.Latitude, result.GeoLocation.Longitude);
+}
+
+static uint64_t hashCapture(uint64_t hash, PhotoLocation &result) {
+    return hashCapture(hash, result.dateTimeOriginal, result.subSecTimeOriginal,
+                       result.latitude, result.longitude);
+}
+
+template <typename Result>
+static uint64_t fingerprintOf(const unsigned char *bytes, size_t length, Result &result) {
+    StageClock clock;
+    uint64_t hash = hashScanData(bytes, length);
+    if (hash)
+    {
+        hash = hashCapture(hash, result);
+        if (hash == 0) hash = 1;
+    }
+    clock.lap(STAGE_HASH);
+    return hash;
+}
+
+template <typename Result>
+static int decodeWith(int readStatus, const unsigned char *bytes, size_t length, Result &result,
+                      uint64_t bufferStart = 0, uint64_t *fingerprint = nullptr) {
+    if (fingerprint) *fingerprint = 0;
+    if (readStatus) return countParse(readStatus);
+    ImageFormat format = sniffImageFormat(bytes, std::min(length, kSniffLength));
+    if (!canReadExif(format)) return countParse(-4);
+    if (format != FORMAT_JPEG)
+    {
+        // All of some other container, mapped or read whole; header reads
+        // have already wrapped its Exif as a JPEG's. Only the Exif is
+        // decoded, picked out by the walk readImageHeader does.
+        ReadBuffer exif;
+        unsigned long exifOffset = 0;
+        extractExifSegment(bytes, length, true, exif, &exifOffset);
+        return decodeWith(0, exif.data(), exif.size(), result, headerBufferStart(exifOffset));
+    }
+    int retval = decode(result, bytes, length);
+    placeThumbnail(result, bufferStart);
+    if (fingerprint && retval == 0) *fingerprint = fingerprintOf(bytes, length, result);
+    return retval;
+}
+
+template <typename Result>
+static int parseWith(const char *fileName, Result &result, ReadMode mode, uint64_t *fingerprint = nullptr) {
+    if (mode == READ_MMAP)
+    {
+        // Pages are faulted in during decode, so there is no read stage.
+        StageClock clock;
+        MappedImage image;
+        int mapVal = image.open(fileName);
+        clock.lap(STAGE_OPEN);
+        return decodeWith(mapVal, image.data(), image.size(), result, 0, fingerprint);
+    }
+    
+    // Both readers time their own open and read stages.
+    ReadBuffer bytes;
+    if (mode == READ_HEADER_ONLY)
+    {
+        HeaderReadStats stats;
+        int readVal = readImageHeader(fileName, bytes, &stats);
+        return decodeWith(readVal, bytes.data(), bytes.size(), result, headerBufferStart(stats.exifOffset),
+                          fingerprint);
+    }
+    int readVal = readWholeFile(fileName, bytes);
+    return decodeWith(readVal, bytes.data(), bytes.size(), result, 0, fingerprint);
+}
+
+template <typename Result>
+static int parseHeaderWith(const char *fileName, ReadBuffer &prefix, bool reachedEnd, Result &result) {
+    ReadBuffer exif;
+    unsigned long exifOffset = 0;
+    if (!extractExifSegment(prefix.data(), prefix.size(), reachedEnd, exif, &exifOffset))
+    {
+        // APP1 starts past the batched read; finish with positioned reads.
+        return parseWith(fileName, result, READ_HEADER_ONLY);
+    }
+    
+    countMetric(COUNT_BYTES_READ, prefix.size());
+    return decodeWith(0, exif.data(), exif.size(), result, headerBufferStart(exifOffset));
+}
+
+int decodeImage(int readStatus, const unsigned char *bytes, size_t length, EXIFInfo &result,
+                uint64_t *fingerprint) {
+    return decodeWith(readStatus, bytes, length, result, 0, fingerprint);
+}
+
+int parseImage(const char *fileName, EXIFInfo &result, ReadMode mode, uint64_t *fingerprint) {
+    return parseWith(fileName, result, mode, fingerprint);
+}
+
+int parseImage(const char *fileName, PhotoLocation &result, ReadMode mode, uint64_t *fingerprint) {
+    return parseWith(fileName, result, mode, fingerprint);
+}
+
+int parseImageHeader(const char *fileName, ReadBuffer &prefix, bool reachedEnd, EXIFInfo &result) {
+    return parseHeaderWith(fileName, prefix, reachedEnd, result);
+}
+
+int parseImageHeader(const char *fileName, ReadBuffer &prefix, bool reachedEnd, PhotoLocation &result) {
+    return parseHeaderWith(fileName, prefix, reachedEnd, result);
+}
+
+// The rows writeJSON writes, in the order it writes them.
+static std::vector<RowId> featureOrder(WorkStealingPool *pool, const std::vector<RowId> *rows) {
+    // The radix sort only reads the time column and yields a permutation;
+    // one gather pass over it then reads just the columns a caller needs.
+    std::vector<RowId> order = photos.sortedByTime(pool);
+    if (!rows) return order;
+    
+    std::vector<bool> selected(photos.size());
+    for (size_t i = 0; i < rows->size(); i++) selected[(*rows)[i]] = true;
+    size_t kept = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        if (selected[order[i]]) order[kept++] = order[i];
+    }
+    order.resize(kept);
+    return order;
+}
+
+void writeJSON(const char *fileName, WorkStealingPool *pool, const std::vector<RowId> *rows) {
+    StageClock clock;
+    GeoJSONWriter writer;
+    if (writer.open(fileName))
+    {
+        printf("Can't create GeoJSON file.\n");
+        return;
+    }
+    
+    std::vector<RowId> order = featureOrder(pool, rows);
+    const std::vector<double> &latitudes = photos.latitudes();
+    const std::vector<double> &longitudes = photos.longitudes();
+    for (std::vector<RowId>::iterator it=order.begin(); it!=order.end(); ++it)
+    {
+        writer.addPoint(longitudes[*it], latitudes[*it]);
+    }
+    
+    if (writer.close())
+    {
+        printf("Can't write GeoJSON file.\n");
+    }
+    clock.lap(STAGE_JSON);
+}
+
+// Copies count bytes at offset in one file to the start of another, in the
+// kernel where it can.
+static bool copySpan(int from, uint64_t offset, size_t count, int to) {
+#if defined(__linux__)
+    loff_t in = (loff_t)offset;
+    while (count > 0) {
+        ssize_t copied = copy_file_range(from, &in, to, nullptr, count, 0);
+        if (copied <= 0) break;
+        count -= copied;
+    }
+    if (count == 0) return true;
+    // Not supported between these files; copy what is left by hand.
+    offset = (uint64_t)in;
+#endif
+    ReadBuffer bytes;
+    bytes.resize(count);
+    size_t done = 0;
+    while (done < count) {
+        ssize_t got = pread(from, bytes.data() + done, count - done, (off_t)(offset + done));
+        if (got <= 0) return false;
+        done += got;
+    }
+    for (done = 0; done < count; ) {
+        ssize_t put = write(to, bytes.data() + done, count - done);
+        if (put <= 0) return false;
+        done += put;
+    }
+    return true;
+}
+
+static bool exportThumbnail(RowId row, const char *fileName) {
+    int from = open(photos.fileName(row), O_RDONLY);
+    if (from < 0) return false;
+    int to = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool copied = to >= 0 &&
+        copySpan(from, photos.thumbnailOffsets()[row], photos.thumbnailLengths()[row], to);
+    if (to >= 0 && close(to)) copied = false;
+    close(from);
+    return copied;
+}
+
+size_t exportThumbnails(const char *directory, WorkStealingPool *pool, const std::vector<RowId> *rows) {
+    std::vector<RowId> order = featureOrder(pool, rows);
+    const std::vector<uint32_t> &lengths = photos.thumbnailLengths();
+    std::atomic<size_t> written(0);
+    
+    // Feature i of the GeoJSON gets directory/i.jpg; photos without an
+    // embedded thumbnail leave a gap in the numbering.
+    auto exportRange = [&](size_t begin, size_t end) {
+        char path[4096];
+        for (size_t i = begin; i < end; i++) {
+            if (lengths[order[i]] == 0) continue;
+            snprintf(path, sizeof(path), "%s/%07zu.jpg", directory, i);
+            if (exportThumbnail(order[i], path)) written++;
+            else fprintf(stderr, "Can't export thumbnail of %s\n", photos.fileName(order[i]));
+        }
+    };
+    
+    const size_t kChunk = 256;
+    if (pool)
+    {
+        for (size_t begin = 0; begin < order.size(); begin += kChunk) {
+            size_t end = std::min(order.size(), begin + kChunk);
+            pool->submit([=, &exportRange] { exportRange(begin, end); });
+        }
+        pool->wait();
+    }
+    else
+    {
+        exportRange(0, order.size());
+    }
+    
+    printf("Wrote %zu thumbnails\n", written.load());
+    return written.load();
+}
+
+size_t collapseDuplicates(const char *reportFile) {
+    const std::vector<uint64_t> &fingerprints = photos.fingerprints();
+    std::vector<RowId> fingerprinted;
+    for (size_t i = 0; i < fingerprints.size(); i++) {
+        if (fingerprints[i]) fingerprinted.push_back((RowId)i);
+    }
+    // Copies end up next to each other, the first file name leading.
+    std::sort(fingerprinted.begin(), fingerprinted.end(), [&](RowId a, RowId b)
+    {
+        if (fingerprints[a] != fingerprints[b]) return fingerprints[a] < fingerprints[b];
+        int byName = strcmp(photos.fileName(a), photos.fileName(b));
+        return byName != 0 ? byName < 0 : a < b;
+    });
+    
+    std::vector<bool> dropped(photos.size());
+    Json::Value groups(Json::arrayValue);
+    size_t droppedCount = 0;
+    for (size_t start = 0; start < fingerprinted.size(); ) {
+        size_t end = start + 1;
+        uint64_t fingerprint = fingerprints[fingerprinted[start]];
+        while (end < fingerprinted.size() && fingerprints[fingerprinted[end]] == fingerprint) end++;
+        if (end - start > 1)
+        {
+            char hex[17];
+            formatFingerprint(hex, fingerprint);
+            Json::Value group;
+            group["fingerprint"] = hex;
+            group["kept"] = photos.fileName(fingerprinted[start]);
+            Json::Value copies(Json::arrayValue);
+            for (size_t i = start + 1; i < end; i++) {
+                dropped[fingerprinted[i]] = true;
+                copies.append(photos.fileName(fingerprinted[i]));
+            }
+            group["duplicates"] = copies;
+            groups.append(group);
+            droppedCount += end - start - 1;
+        }
+        start = end;
+    }
+    
+    Json::Value report;
+    report["groups"] = groups;
+    report["duplicateFiles"] = (Json::UInt64)droppedCount;
+    Json::StyledWriter styledWriter;
+    std::string text = styledWriter.write(report);
+    FILE *fp = fopen(reportFile, "wb");
+    bool failed = !fp || fwrite(text.data(), 1, text.size(), fp) != text.size();
+    if (fp && fclose(fp) != 0) failed = true;
+    if (failed) printf("Can't write duplicates file.\n");
+    
+    // The names are read above, so the table only changes at the end.
+    if (droppedCount)
+    {
+        std::vector<RowId> kept;
+        kept.reserve(photos.size() - droppedCount);
+        for (size_t i = 0; i < dropped.size(); i++) {
+            if (!dropped[i]) kept.push_back((RowId)i);
+        }
+        photos.keepRows(kept);
+    }
+    countMetric(COUNT_DUPLICATES, droppedCount);
+    printf("%u duplicate groups, %zu copies collapsed\n", groups.size(), droppedCount);
+    return droppedCount;
+}
+
+// Keeps a photo with a capture time and a location; clock has just timed
+// the timestamp.
+static void collect(const char *fileName, int64_t timeTaken, double latitude, double longitude,
+                    double altitude, uint64_t fileSize, uint64_t fingerprint, StageClock &clock,
+                    uint64_t thumbnailOffset = 0, uint32_t thumbnailLength = 0) {
+    if (timeTaken == kUnknownTime)
+    {
+        countMetric(COUNT_NO_TIMESTAMP);
+        return;
+    }
+    
+    if (latitude > 0 && longitude > 0)
+    {
+        {
+            std::lock_guard<std::mutex> guard(photosLock);
+            if (streamedFeatures.isOpen())
+            {
+                streamedFeatures.addPoint(longitude, latitude);
+            }
+            else
+            {
+                photos.append(fileName, latitude, longitude, altitude, timeTaken, fileSize,
+                              thumbnailOffset, thumbnailLength, fingerprint);
+            }
+        }
+        clock.lap(STAGE_COLLECT);
+        countMetric(COUNT_PHOTOS_COLLECTED);
+    }
+    else
+    {
+        countMetric(COUNT_NO_LOCATION);
+    }
+}
+
+void addPhoto(const char *fileName, EXIFInfo &result, uint64_t fileSize, uint64_t fingerprint) {
+    StageClock clock;
+    int64_t timeTaken = exifTimeToEpochNanos(result);
+    clock.lap(STAGE_TIMESTAMP);
+    collect(fileName, timeTaken, result.GeoLocation.Latitude, result.GeoLocation.Longitude,
+            result.GeoLocation.Altitude, fileSize, fingerprint, clock);
+}
+
+void addPhoto(const char *fileName, const PhotoLocation &location, uint64_t fileSize,
+              uint64_t fingerprint) {
+    StageClock clock;
+    int64_t timeTaken = parseExifTimestamp(location.dateTimeOriginal, location.subSecTimeOriginal,
+                                           location.offsetTimeOriginal);
+    clock.lap(STAGE_TIMESTAMP);
+    collect(fileName, timeTaken, location.latitude, location.longitude, location.altitude, fileSize,
+            fingerprint, clock, location.thumbnailOffset, location.thumbnailLength);
+}
+
+void printExifInfo(const char *fileName, EXIFInfo &result) {
+    printf("Camera make       : %s\n", result.Make.c_str());
+    printf("Camera model      : %s\n", result.Model.c_str());
+    printf("Software          : %s\n", result.Software.c_str());
+    printf("Bits per sample   : %d\n", result.BitsPerSample);
+    printf("Image width       : %d\n", result.ImageWidth);
+    printf("Image height      : %d\n", result.ImageHeight);
+    printf("Image description : %s\n", result.ImageDescription.c_str());
+    printf("Image orientation : %d\n", result.Orientation);
+    printf("Image copyright   : %s\n", result.Copyright.c_str());
+    printf("Image date/time   : %s\n", result.DateTime.c_str());
+    printf("Original date/time: %s\n", result.DateTimeOriginal.c_str());
+    printf("Digitize date/time: %s\n", result.DateTimeDigitized.c_str());
+    printf("Subsecond time    : %s\n", result.SubSecTimeOriginal.c_str());
+    printf("Exposure time     : 1/%d s\n", (unsigned) (1.0/result.ExposureTime));
+    printf("F-stop            : f/%.1f\n", result.FNumber);
+    printf("ISO speed         : %d\n", result.ISOSpeedRatings);
+    printf("Subject distance  : %f m\n", result.SubjectDistance);
+    printf("Exposure bias     : %f EV\n", result.ExposureBiasValue);
+    printf("Flash used?       : %d\n", result.Flash);
+    printf("Metering mode     : %d\n", result.MeteringMode);
+    printf("Lens focal length : %f mm\n", result.FocalLength);
+    printf("35mm focal length : %u mm\n", result.FocalLengthIn35mm);
+    printf("GPS Latitude      : %f deg (%f deg, %f min, %f sec %c)\n",
+           result.GeoLocation.Latitude,
+           result.GeoLocation.LatComponents.degrees,
+           result.GeoLocation.LatComponents.minutes,
+           result.GeoLocation.LatComponents.seconds,
+           result.GeoLocation.LatComponents.direction);
+    printf("GPS Longitude     : %f deg (%f deg, %f min, %f sec %c)\n",
+           result.GeoLocation.Longitude,
+           result.GeoLocation.LonComponents.degrees,
+           result.GeoLocation.LonComponents.minutes,
+           result.GeoLocation.LonComponents.seconds,
+           result.GeoLocation.LonComponents.direction);
+    printf("GPS Altitude      : %f m\n", result.GeoLocation.Altitude);
+    
+    printf("----------------------------------------------------------------\n");
+    
+}
+
+void writeCSVHeader(CSVWriter &csvFile, bool fingerprints) {
+    csvFile.rawField("timeStamp,subsectime,fileName,width,height,size,latitude,longitude,elevation,shutterspeed,iso,aperature,iosver,orientation");
+    if (fingerprints) csvFile.rawField("fingerprint");
+    csvFile.endRow();
+}
+
+void writeCSVLine(CSVWriter &csvFile, EXIFInfo &result, const char *fileName, const uint64_t *fingerprint) {
+    StageClock clock;
+    char shutter[40] = "1.0/";
+    formatDouble(shutter + 4, result.ExposureTime);
+    
+    csvFile.field(result.DateTimeOriginal);
+    csvFile.field(result.SubSecTimeOriginal);
+    csvFile.field(fileName);
+    csvFile.field(result.ImageWidth);
+    csvFile.field(result.ImageHeight);
+    csvFile.rawField("0");
+    csvFile.field(result.GeoLocation.Latitude);
+    csvFile.field(result.GeoLocation.Longitude);
+    csvFile.field(result.GeoLocation.Altitude);
+    csvFile.rawField(shutter);
+    csvFile.field((unsigned)result.ISOSpeedRatings);
+    csvFile.field(result.FNumber);
+    csvFile.field(result.Software);
+    csvFile.field((unsigned)result.Orientation);
+    if (fingerprint)
+    {
+        char hex[17];
+        formatFingerprint(hex, *fingerprint);
+        csvFile.rawField(hex);
+    }
+    csvFile.endRow();
+    clock.lap(STAGE_CSV);
+    countMetric(COUNT_CSV_ROWS);
+}
+
+void writeColumnarRow(ColumnarWriter &columnar, EXIFInfo &result, const char *fileName, uint64_t fileSize) {
+    ColumnarRow row;
+    row.fileName = fileName;
+    row.timeTaken = exifTimeToEpochNanos(result);
+    row.latitude = result.GeoLocation.Latitude;
+    row.longitude = result.GeoLocation.Longitude;
+    row.altitude = result.GeoLocation.Altitude;
+    row.fileSize = fileSize;
+    row.width = result.ImageWidth;
+    row.height = result.ImageHeight;
+    row.iso = result.ISOSpeedRatings;
+    row.orientation = result.Orientation;
+    row.fNumber = result.FNumber;
+    row.exposureTime = result.ExposureTime;
+    row.software = result.Software.c_str();
+    row.make = result.Make.c_str();
+    row.model = result.Model.c_str();
+    columnar.append(row);
+}
+
+// DateTimeOriginal plus SubSecTimeOriginal, read as UTC: easyexif doesn't
+// surface OffsetTimeOriginal. Returns kUnknownTime when the field is missing.
+int64_t exifTimeToEpochNanos(const EXIFInfo &result) {
+    return parseExifTimestamp(result.DateTimeOriginal, result.SubSecTimeOriginal);
+}
@@ -0,0 +1,104 @@
+//
+//  pipeline.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__pipeline__
+#define __photo_exif_parsing__pipeline__
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+#include "exif.h"
+#include "exif_decoder.h"
+#include "columnar_writer.h"
+#include "csv_writer.h"
+#include "geojson_writer.h"
+#include "image_reader.h"
+#include "photo_table.h"
+
+class WorkStealingPool;
+
+// The per-photo steps of an ingest run, shared by the command line tool and
+// the benchmark: read and decode a file, collect located photos, and format
+// the CSV, columnar and GeoJSON outputs.
+
+// Photos with a location, collected for the GeoJSON output. Appends come
+// from the pool threads and are serialized by photosLock.
+extern PhotoTable photos;
+extern std::mutex photosLock;
+
+// When open, addPhoto writes features straight here, in arrival order and
+// without keeping the table.
+extern GeoJSONWriter streamedFeatures;
+
+// Returns 0, -1 if the file can't be opened, -2 if it can't be read, -3
+// if the EXIF data doesn't parse or -4 if the file isn't in a format Exif
+// is read from. The format is told by the first bytes, not the name (see
+// image_format.h); HEIF, PNG, WebP and TIFF files are read for their Exif
+// in every mode (see readImageHeader).
+//
+// With fingerprint, a successful decode also hashes the file's scan data
+// and capture fields into it (see fingerprint.h), from the bytes already
+// read; it is 0 otherwise, always with READ_HEADER_ONLY, whose bytes stop
+// before the scan data, and for HEIF files, which have no JPEG scan.
+int parseImage(const char *fileName, EXIFInfo &result, ReadMode mode = READ_HEADER_ONLY,
+               uint64_t *fingerprint = nullptr);
+
+// The decode half of parseImage, for bytes from readImageHeader or
+// readWholeFile. A failed read (readStatus != 0) is counted and returned
+// without decoding anything.
+int decodeImage(int readStatus, const unsigned char *bytes, size_t length, EXIFInfo &result,
+                uint64_t *fingerprint = nullptr);
+
+// Same, for a file whose first bytes are already in prefix (reachedEnd when
+// prefix is the whole file).
+int parseImageHeader(const char *fileName, ReadBuffer &prefix, bool reachedEnd, EXIFInfo &result);
+
+// Keeps photos with a capture time and a location. Safe to call from any
+// thread.
+void addPhoto(const char *fileName, EXIFInfo &result, uint64_t fileSize, uint64_t fingerprint = 0);
+
+// Just the fields addPhoto needs, for runs that only write GeoJSON. They
+// are decoded straight from the IFDs without filling an EXIFInfo, and the
+// capture time honours OffsetTimeOriginal where EXIFInfo's reads as UTC.
+// The thumbnail span comes along so it can be exported without another
+// parse; it is rebased to a file offset before addPhoto sees it.
+typedef ExifRecord<EXIF_TIME | EXIF_LOCATION | EXIF_THUMBNAIL> PhotoLocation;
+
+int parseImage(const char *fileName, PhotoLocation &result, ReadMode mode = READ_HEADER_ONLY,
+               uint64_t *fingerprint = nullptr);
+int parseImageHeader(const char *fileName, ReadBuffer &prefix, bool reachedEnd, PhotoLocation &result);
+void addPhoto(const char *fileName, const PhotoLocation &location, uint64_t fileSize,
+              uint64_t fingerprint = 0);
+
+// Collapses collected photos that share a fingerprint down to the one with
+// the first file name, before writeJSON and the indexes see the table.
+// Each group is written to reportFile as JSON (fingerprint, kept file,
+// dropped files). Returns how many rows were dropped; photos without a
+// fingerprint are never merged. The pool must be idle.
+size_t collapseDuplicates(const char *reportFile);
+
+// Writes the collected photos to fileName as GeoJSON, oldest first. With
+// rows, only those rows are written (duplicates are fine). The pool, if
+// given, must be idle.
+void writeJSON(const char *fileName, WorkStealingPool *pool, const std::vector<RowId> *rows);
+
+// Copies the embedded thumbnail of each photo writeJSON would write into
+// directory, named after its feature's position in the GeoJSON
+// (0000000.jpg, ...). The bytes are copied file to file from the span the
+// decoder recorded, with copy_file_range on Linux, and never decoded.
+// Returns how many were written.
+size_t exportThumbnails(const char *directory, WorkStealingPool *pool, const std::vector<RowId> *rows);
+
+void printExifInfo(const char *fileName, EXIFInfo &result);
+// With fingerprints the rows end in a fingerprint column, 16 hex digits or
+// empty, that duplicate copies share.
+void writeCSVHeader(CSVWriter &csvFile, bool fingerprints = false);
+void writeCSVLine(CSVWriter &csvFile, EXIFInfo &result, const char *fileName,
+                  const uint64_t *fingerprint = nullptr);
+void writeColumnarRow(ColumnarWriter &columnar, EXIFInfo &result, const char *fileName, uint64_t fileSize);
+int64_t exifTimeToEpochNanos(const EXIFInfo &result);
+
+#endif /* defined(__photo_exif_parsing__pipeline__) */
@@ -0,0 +1,118 @@
+//
+//  radix_sort.cpp
+//  photo-exif-parsing
+//
+
+#include "radix_sort.h"
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace {
+    const unsigned kDigitBits = 11;
+    const size_t kBuckets = 1 << kDigitBits;
+    const unsigned kPasses = (64 + kDigitBits - 1) / kDigitBits;
+
+    // Below this many keys per chunk the pool costs more than it saves.
+    const size_t kMinChunk = 1 << 16;
+
+    inline size_t digitOf(uint64_t key, unsigned pass) {
+        return (size_t)(key >> (pass * kDigitBits)) & (kBuckets - 1);
+    }
+
+    void forEachChunk(WorkStealingPool *pool, size_t chunks, const std::function<void(size_t)> &body) {
+        if (!pool || chunks == 1)
+        {
+            for (size_t c = 0; c < chunks; c++) body(c);
+            return;
+        }
+        for (size_t c = 0; c < chunks; c++) {
+            pool->submit([&body, c]() { body(c); });
+        }
+        pool->wait();
+    }
+}
+
+void radixSortOrder(const uint64_t *keys, size_t count, std::vector<uint32_t> &order,
+                    WorkStealingPool *pool) {
+    order.resize(count);
+    for (size_t i = 0; i < count; i++) order[i] = (uint32_t)i;
+    if (count < 2) return;
+
+    size_t chunks = 1;
+    if (pool)
+    {
+        chunks = std::max<size_t>(1, std::min<size_t>(pool->size(), count / kMinChunk));
+    }
+    size_t chunkSize = (count + chunks - 1) / chunks;
+
+    // Keys travel with their indices so every pass reads sequentially.
+    std::vector<uint64_t> keysIn(keys, keys + count), keysOut(count);
+    std::vector<uint32_t> scratch(count);
+    uint32_t *indexIn = &order[0];
+    uint32_t *indexOut = &scratch[0];
+
+    // One read up front gives every pass's digit histogram: passes whose
+    // digit is the same for all keys are dropped, and a single chunk needs
+    // no further counting.
+    std::vector<size_t> digitCounts(kPasses * kBuckets);
+    for (size_t i = 0; i < count; i++) {
+        for (unsigned pass = 0; pass < kPasses; pass++) {
+            digitCounts[pass * kBuckets + digitOf(keysIn[i], pass)]++;
+        }
+    }
+
+    // counts[c * kBuckets + d]: keys in chunk c with digit d, turned into
+    // the chunk's first output slot for that digit.
+    std::vector<size_t> counts(chunks * kBuckets);
+
+    for (unsigned pass = 0; pass < kPasses; pass++) {
+        const size_t *totals = &digitCounts[pass * kBuckets];
+        if (std::find(totals, totals + kBuckets, count) != totals + kBuckets) continue;
+
+        if (chunks == 1)
+        {
+            std::copy(totals, totals + kBuckets, counts.begin());
+        }
+        else
+        {
+            std::fill(counts.begin(), counts.end(), 0);
+            forEachChunk(pool, chunks, [&](size_t c)
+            {
+                size_t *histogram = &counts[c * kBuckets];
+                size_t end = std::min(count, (c + 1) * chunkSize);
+                for (size_t i = c * chunkSize; i < end; i++) {
+                    histogram[digitOf(keysIn[i], pass)]++;
+                }
+            });
+        }
+
+        // Digit-major, chunk-minor prefix sum: chunk c's keys with digit d
+        // land after every earlier chunk's, so equal digits keep input order.
+        size_t offset = 0;
+        for (size_t d = 0; d < kBuckets; d++) {
+            for (size_t c = 0; c < chunks; c++) {
+                size_t n = counts[c * kBuckets + d];
+                counts[c * kBuckets + d] = offset;
+                offset += n;
+            }
+        }
+
+        forEachChunk(pool, chunks, [&](size_t c)
+        {
+            size_t *next = &counts[c * kBuckets];
+            size_t end = std::min(count, (c + 1) * chunkSize);
+            for (size_t i = c * chunkSize; i < end; i++) {
+                size_t slot = next[digitOf(keysIn[i], pass)]++;
+                keysOut[slot] = keysIn[i];
+                indexOut[slot] = indexIn[i];
+            }
+        });
+
+        keysIn.swap(keysOut);
+        std::swap(indexIn, indexOut);
+    }
+
+    if (indexIn != &order[0]) order.swap(scratch);
+}
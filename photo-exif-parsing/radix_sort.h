@@ -0,0 +1,42 @@
+//
+//  radix_sort.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__radix_sort__
+#define __photo_exif_parsing__radix_sort__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+class WorkStealingPool;
+
+// Maps a signed key onto an unsigned one with the same ordering.
+inline uint64_t radixKey(int64_t key) {
+    return (uint64_t)key ^ (1ULL << 63);
+}
+
+// Same for doubles: negatives get every bit flipped, positives just the
+// sign bit, so the unsigned order matches the numeric one.
+inline uint64_t radixKey(double key) {
+    uint64_t bits;
+    memcpy(&bits, &key, sizeof(bits));
+    return (bits & (1ULL << 63)) ? ~bits : bits | (1ULL << 63);
+}
+
+// Stable LSD radix sort of keys[0, count) that leaves the keys alone and
+// fills order with the sorted permutation of indices; callers then gather
+// whichever columns they need in one pass.
+//
+// Keys are sorted 11 bits at a time. Passes where every key has the same
+// digit (the high bits of timestamps from a few decades) are skipped. With a
+// pool, each pass splits the input into one chunk per worker that builds
+// its own histogram and scatters into its own slice of the output, which
+// keeps the sort stable. The pool must be otherwise idle, since the sort
+// waits on it between passes.
+void radixSortOrder(const uint64_t *keys, size_t count, std::vector<uint32_t> &order,
+                    WorkStealingPool *pool = nullptr);
+
+#endif /* defined(__photo_exif_parsing__radix_sort__) */
@@ -0,0 +1,216 @@
+//
+//  spatial_index.cpp
+//  photo-exif-parsing
+//
+
+#include "spatial_index.h"
+#include "radix_sort.h"
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const double kEarthRadiusMeters = 6371008.8;
+    const double kDegreesToRadians = M_PI / 180.0;
+
+    double haversineMeters(double lat1, double lon1, double lat2, double lon2) {
+        double dLat = (lat2 - lat1) * kDegreesToRadians;
+        double dLon = (lon2 - lon1) * kDegreesToRadians;
+        double a = sin(dLat / 2) * sin(dLat / 2) +
+                   cos(lat1 * kDegreesToRadians) * cos(lat2 * kDegreesToRadians) *
+                   sin(dLon / 2) * sin(dLon / 2);
+        return 2 * kEarthRadiusMeters * asin(std::min(1.0, sqrt(a)));
+    }
+}
+
+SpatialIndex::SpatialIndex(unsigned nodeCapacity)
+: capacity(std::max(2u, nodeCapacity))
+{
+}
+
+void SpatialIndex::build(const PhotoTable &photos, WorkStealingPool *pool) {
+    size_t count = photos.size();
+    const std::vector<double> &latitudes = photos.latitudes();
+    const std::vector<double> &longitudes = photos.longitudes();
+
+    latitude.resize(count);
+    longitude.resize(count);
+    ids.clear();
+    nodes.clear();
+    levelStart.clear();
+    if (count == 0) return;
+
+    // Longitude order for the whole set, via the same radix sort as time.
+    std::vector<uint64_t> keys(count);
+    for (size_t i = 0; i < count; i++) keys[i] = radixKey(longitudes[i]);
+    radixSortOrder(&keys[0], count, ids, pool);
+    std::vector<uint64_t>().swap(keys);
+
+    // sqrt(leaves) vertical slices, each a whole number of leaves.
+    size_t leaves = (count + capacity - 1) / capacity;
+    size_t slices = (size_t)ceil(sqrt((double)leaves));
+    size_t sliceSize = ((leaves + slices - 1) / slices) * capacity;
+    slices = (count + sliceSize - 1) / sliceSize;
+    nodes.resize(leaves);
+
+    auto packSlice = [&](size_t slice)
+    {
+        size_t begin = slice * sliceSize;
+        size_t end = std::min(count, begin + sliceSize);
+        std::sort(ids.begin() + begin, ids.begin() + end, [&latitudes](RowId a, RowId b)
+        {
+            return latitudes[a] < latitudes[b];
+        });
+
+        for (size_t first = begin; first < end; first += capacity) {
+            Box &box = nodes[first / capacity];
+            box.minLatitude = box.minLongitude = INFINITY;
+            box.maxLatitude = box.maxLongitude = -INFINITY;
+            for (size_t i = first; i < std::min(end, first + capacity); i++) {
+                double lat = latitude[i] = latitudes[ids[i]];
+                double lon = longitude[i] = longitudes[ids[i]];
+                box.minLatitude = std::min(box.minLatitude, lat);
+                box.maxLatitude = std::max(box.maxLatitude, lat);
+                box.minLongitude = std::min(box.minLongitude, lon);
+                box.maxLongitude = std::max(box.maxLongitude, lon);
+            }
+        }
+    };
+    if (pool && slices > 1)
+    {
+        for (size_t s = 0; s < slices; s++) {
+            pool->submit([&packSlice, s]() { packSlice(s); });
+        }
+        pool->wait();
+    }
+    else
+    {
+        for (size_t s = 0; s < slices; s++) packSlice(s);
+    }
+
+    // Each upper level packs runs of capacity nodes from the one below.
+    levelStart.push_back(0);
+    size_t levelBegin = 0, levelSize = leaves;
+    while (levelSize > 1) {
+        size_t parents = (levelSize + capacity - 1) / capacity;
+        levelStart.push_back(nodes.size());
+        for (size_t p = 0; p < parents; p++) {
+            Box box = nodes[levelBegin + p * capacity];
+            size_t last = std::min(levelSize, (p + 1) * capacity);
+            for (size_t c = p * capacity + 1; c < last; c++) {
+                const Box &child = nodes[levelBegin + c];
+                box.minLatitude = std::min(box.minLatitude, child.minLatitude);
+                box.maxLatitude = std::max(box.maxLatitude, child.maxLatitude);
+                box.minLongitude = std::min(box.minLongitude, child.minLongitude);
+                box.maxLongitude = std::max(box.maxLongitude, child.maxLongitude);
+            }
+            nodes.push_back(box);
+        }
+        levelBegin = levelStart.back();
+        levelSize = parents;
+    }
+}
+
+void SpatialIndex::search(double minLatitude, double minLongitude,
+                          double maxLatitude, double maxLongitude,
+                          std::vector<size_t> &leafPoints) const {
+    if (nodes.empty()) return;
+
+    // (level, node) pairs still to visit, starting at the root.
+    std::vector<std::pair<size_t, size_t> > stack;
+    stack.push_back(std::make_pair(levelStart.size() - 1, (size_t)0));
+    while (!stack.empty()) {
+        size_t level = stack.back().first;
+        size_t node = stack.back().second;
+        stack.pop_back();
+
+        const Box &box = nodes[levelStart[level] + node];
+        if (box.maxLatitude < minLatitude || box.minLatitude > maxLatitude ||
+            box.maxLongitude < minLongitude || box.minLongitude > maxLongitude) continue;
+
+        size_t first = node * capacity;
+        if (level == 0)
+        {
+            size_t last = std::min(ids.size(), first + capacity);
+            bool contained = box.minLatitude >= minLatitude && box.maxLatitude <= maxLatitude &&
+                             box.minLongitude >= minLongitude && box.maxLongitude <= maxLongitude;
+            for (size_t i = first; i < last; i++) {
+                if (contained || (latitude[i] >= minLatitude && latitude[i] <= maxLatitude &&
+                                  longitude[i] >= minLongitude && longitude[i] <= maxLongitude)) {
+                    leafPoints.push_back(i);
+                }
+            }
+            continue;
+        }
+
+        size_t below = levelStart[level] - levelStart[level - 1];
+        size_t last = std::min(below, first + capacity);
+        for (size_t child = first; child < last; child++) {
+            stack.push_back(std::make_pair(level - 1, child));
+        }
+    }
+}
+
+void SpatialIndex::queryBox(double minLatitude, double minLongitude,
+                            double maxLatitude, double maxLongitude,
+                            std::vector<RowId> &rows) const {
+    std::vector<size_t> points;
+    if (minLongitude > maxLongitude)
+    {
+        search(minLatitude, minLongitude, maxLatitude, 180.0, points);
+        search(minLatitude, -180.0, maxLatitude, maxLongitude, points);
+    }
+    else
+    {
+        search(minLatitude, minLongitude, maxLatitude, maxLongitude, points);
+    }
+    for (size_t i = 0; i < points.size(); i++) rows.push_back(ids[points[i]]);
+}
+
+void SpatialIndex::queryRadius(double lat, double lon, double radiusMeters,
+                               std::vector<RowId> &rows) const {
+    // Candidates come from the enclosing box, then the exact distance.
+    double dLat = radiusMeters / kEarthRadiusMeters / kDegreesToRadians;
+    double minLatitude = lat - dLat, maxLatitude = lat + dLat;
+
+    std::vector<size_t> points;
+    if (minLatitude <= -90.0 || maxLatitude >= 90.0)
+    {
+        // The circle covers a pole, so every longitude is in play.
+        search(std::max(-90.0, minLatitude), -180.0, std::min(90.0, maxLatitude), 180.0, points);
+    }
+    else
+    {
+        // Widest longitude span of the circle, reached where it touches the
+        // meridians tangentially; past 1 it wraps the whole parallel.
+        double reach = sin(radiusMeters / kEarthRadiusMeters) / cos(lat * kDegreesToRadians);
+        double dLon = reach < 1.0 ? asin(reach) / kDegreesToRadians : 180.0;
+        double minLongitude = lon - dLon, maxLongitude = lon + dLon;
+        if (dLon >= 180.0)
+        {
+            search(minLatitude, -180.0, maxLatitude, 180.0, points);
+        }
+        else if (minLongitude < -180.0)
+        {
+            search(minLatitude, minLongitude + 360.0, maxLatitude, 180.0, points);
+            search(minLatitude, -180.0, maxLatitude, maxLongitude, points);
+        }
+        else if (maxLongitude > 180.0)
+        {
+            search(minLatitude, minLongitude, maxLatitude, 180.0, points);
+            search(minLatitude, -180.0, maxLatitude, maxLongitude - 360.0, points);
+        }
+        else
+        {
+            search(minLatitude, minLongitude, maxLatitude, maxLongitude, points);
+        }
+    }
+
+    for (size_t i = 0; i < points.size(); i++) {
+        size_t p = points[i];
+        if (haversineMeters(lat, lon, latitude[p], longitude[p]) <= radiusMeters) {
+            rows.push_back(ids[p]);
+        }
+    }
+}
@@ -0,0 +1,73 @@
+//
+//  spatial_index.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__spatial_index__
+#define __photo_exif_parsing__spatial_index__
+
+#include <stddef.h>
+#include <vector>
+
+#include "photo_table.h"
+
+class WorkStealingPool;
+
+// Read-only packed R-tree over photo coordinates, bulk loaded with
+// Sort-Tile-Recursive: points are ordered by longitude, cut into vertical
+// slices, each slice ordered by latitude and packed into full leaves. Upper
+// levels pack consecutive nodes of the level below, so every node is full
+// and the tree is a handful of flat arrays with no pointers.
+//
+// Queries return row ids of the table the index was built from. Build
+// again after appending rows.
+class SpatialIndex
+{
+public:
+    explicit SpatialIndex(unsigned nodeCapacity = 16);
+
+    // Indexes every row of photos. With a pool the longitude sort and the
+    // per-slice latitude sorts and leaf packing run on its workers; the pool
+    // must be otherwise idle.
+    void build(const PhotoTable &photos, WorkStealingPool *pool = nullptr);
+
+    size_t size() const { return ids.size(); }
+
+    // Appends the rows inside the box (edges included) to rows, in no
+    // particular order. Boxes crossing the antimeridian have
+    // minLongitude > maxLongitude.
+    void queryBox(double minLatitude, double minLongitude,
+                  double maxLatitude, double maxLongitude,
+                  std::vector<RowId> &rows) const;
+
+    // Appends the rows within radiusMeters great-circle distance of the
+    // point to rows, in no particular order.
+    void queryRadius(double latitude, double longitude, double radiusMeters,
+                     std::vector<RowId> &rows) const;
+
+private:
+    struct Box
+    {
+        double minLatitude, minLongitude;
+        double maxLatitude, maxLongitude;
+    };
+
+    void search(double minLatitude, double minLongitude,
+                double maxLatitude, double maxLongitude,
+                std::vector<size_t> &leafPoints) const;
+
+    size_t capacity;
+
+    // Points in leaf order; leaf i holds [i * capacity, (i + 1) * capacity).
+    std::vector<double> latitude;
+    std::vector<double> longitude;
+    std::vector<RowId> ids;
+
+    // Node boxes, leaves first and the root last. Node i of level k covers
+    // nodes [i * capacity, (i + 1) * capacity) of level k - 1, or points
+    // for the leaf level.
+    std::vector<Box> nodes;
+    std::vector<size_t> levelStart;
+};
+
+#endif /* defined(__photo_exif_parsing__spatial_index__) */
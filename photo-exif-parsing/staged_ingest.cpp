@@ -0,0 +1,163 @@
+//
+//  staged_ingest.cpp
+//  photo-exif-parsing
+//
+
+#include "staged_ingest.h"
+#include "bounded_queue.h"
+#include "buffer_pool.h"
+#include "pipeline.h"
+
+#include <thread>
+#include <vector>
+
+namespace {
+    // A file on its way from the read stage to the decode stage.
+    struct ReadFile
+    {
+        std::string fileName;
+        FileKey key;
+        bool haveKey;
+        int status;
+        ReadBuffer bytes;
+    };
+
+    struct DecodedFile
+    {
+        std::string fileName;
+        FileKey key;
+        bool haveKey;
+        int status;
+        bool lookedUp;
+        uint64_t fingerprint;
+        EXIFInfo result;
+    };
+
+    // Rows are handed to the write stage in chunks of about this size, or
+    // sooner when the format stage runs out of input.
+    const size_t kRowChunk = 64 * 1024;
+
+    void joinAll(std::vector<std::thread> &threads) {
+        for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+        threads.clear();
+    }
+}
+
+size_t runStagedIngest(const std::string &root, const WalkOptions &walkOptions,
+                       const StagedIngestOptions &options, const StagedLookup &lookup,
+                       const StagedFormat &format, CSVWriter &csv) {
+    BoundedQueue<std::string> paths(QUEUE_PATHS, options.queueDepth);
+    // Free blocks the buffer pool keeps between reads are file data too, so
+    // half the budget goes to the pool and half to queued reads. Decoders
+    // free blocks faster than readers take them back, and a smaller share
+    // drops most of those multi-megabyte blocks before they are reused.
+    size_t poolBudget = options.memoryBudget / 2;
+    size_t previousPoolLimit = setBufferPoolLimit(poolBudget);
+    BoundedQueue<ReadFile> reads(QUEUE_READS, options.queueDepth, options.memoryBudget - poolBudget);
+    BoundedQueue<DecodedFile> decoded(QUEUE_DECODED, options.queueDepth);
+    BoundedQueue<std::vector<char> > rows(QUEUE_ROWS, options.queueDepth / 16 + 1);
+
+    unsigned decoders = options.decoders ? options.decoders : std::thread::hardware_concurrency();
+    if (decoders == 0) decoders = 1;
+
+    std::vector<std::thread> readThreads;
+    for (unsigned i = 0; i < (options.readers ? options.readers : 1); i++) {
+        readThreads.push_back(std::thread([&] {
+            std::string fileName;
+            while (paths.pop(fileName)) {
+                ReadFile file;
+                file.fileName.swap(fileName);
+                file.haveKey = PhotoIndex::statKey(file.fileName.c_str(), file.key);
+
+                DecodedFile answer;
+                if (file.haveKey && lookup && lookup(file.key, answer.result, answer.status))
+                {
+                    answer.fileName.swap(file.fileName);
+                    answer.key = file.key;
+                    answer.haveKey = true;
+                    answer.lookedUp = true;
+                    answer.fingerprint = 0;
+                    decoded.push(std::move(answer));
+                    continue;
+                }
+
+                if (options.readMode == READ_HEADER_ONLY) file.status = readImageHeader(file.fileName.c_str(), file.bytes);
+                else if (options.readMode == READ_WHOLE_FILE) file.status = readWholeFile(file.fileName.c_str(), file.bytes);
+                else file.status = 0;
+                size_t size = file.bytes.size();
+                reads.push(std::move(file), size);
+            }
+        }));
+    }
+
+    std::vector<std::thread> decodeThreads;
+    for (unsigned i = 0; i < decoders; i++) {
+        decodeThreads.push_back(std::thread([&] {
+            ReadFile file;
+            while (reads.pop(file)) {
+                DecodedFile out;
+                out.fingerprint = 0;
+                uint64_t *fingerprint = options.fingerprint ? &out.fingerprint : nullptr;
+                if (options.readMode == READ_MMAP)
+                {
+                    out.status = parseImage(file.fileName.c_str(), out.result, READ_MMAP, fingerprint);
+                }
+                else
+                {
+                    out.status = decodeImage(file.status, file.bytes.data(), file.bytes.size(), out.result,
+                                             fingerprint);
+                }
+                // The bytes are done with; free them before waiting on the
+                // next queue.
+                file.bytes.release();
+                out.fileName.swap(file.fileName);
+                out.key = file.key;
+                out.haveKey = file.haveKey;
+                out.lookedUp = false;
+                decoded.push(std::move(out));
+            }
+        }));
+    }
+
+    std::thread formatThread([&] {
+        CSVWriter formatted(kRowChunk * 2);
+        DecodedFile file;
+        while (decoded.pop(file)) {
+            format(file.fileName, file.haveKey ? &file.key : nullptr, file.result,
+                   file.status, file.lookedUp, file.fingerprint, formatted);
+            if (formatted.buffered() >= kRowChunk || decoded.empty())
+            {
+                std::vector<char> chunk;
+                formatted.takeRows(chunk);
+                size_t size = chunk.size();
+                if (size) rows.push(std::move(chunk), size);
+            }
+        }
+        std::vector<char> chunk;
+        formatted.takeRows(chunk);
+        size_t size = chunk.size();
+        if (size) rows.push(std::move(chunk), size);
+    });
+
+    std::thread writeThread([&] {
+        std::vector<char> chunk;
+        while (rows.pop(chunk)) csv.appendRows(chunk);
+    });
+
+    // The walk is the enumerate stage; a full paths queue blocks its sink.
+    size_t files = walkDirectory(root, walkOptions, [&](const std::string &fileName) {
+        paths.push(fileName);
+    });
+
+    // Each queue is closed once everything that feeds it has finished.
+    paths.close();
+    joinAll(readThreads);
+    reads.close();
+    joinAll(decodeThreads);
+    decoded.close();
+    formatThread.join();
+    rows.close();
+    writeThread.join();
+    setBufferPoolLimit(previousPoolLimit);
+    return files;
+}
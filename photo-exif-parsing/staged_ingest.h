@@ -0,0 +1,71 @@
+//
+//  staged_ingest.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__staged_ingest__
+#define __photo_exif_parsing__staged_ingest__
+
+#include <stddef.h>
+#include <functional>
+#include <string>
+
+#include "exif.h"
+#include "csv_writer.h"
+#include "directory_walker.h"
+#include "image_reader.h"
+#include "photo_index.h"
+
+struct StagedIngestOptions
+{
+    // Bytes of file data allowed to wait between the read and decode
+    // stages, including the free read buffers the buffer pool keeps cached
+    // (half of it). Together with queueDepth this caps what the
+    // pipeline holds however many files the walk turns up.
+    size_t memoryBudget;
+    // Entries per hand-off queue.
+    size_t queueDepth;
+    unsigned readers;
+    // 0 picks hardware_concurrency().
+    unsigned decoders;
+    // READ_MMAP maps files on the decode stage, so only header and
+    // whole-file reads are charged to memoryBudget.
+    ReadMode readMode;
+    // Take a content fingerprint of each file on the decode stage; it needs
+    // whole-file or mmap reads to see the scan data.
+    bool fingerprint;
+
+    StagedIngestOptions()
+    : memoryBudget(64 << 20), queueDepth(1024), readers(4), decoders(0), readMode(READ_HEADER_ONLY),
+      fingerprint(false) {}
+};
+
+// Called on a reader thread with the file's stat key. Returning true
+// answers the file from elsewhere (result and status as parseImage would
+// leave them) and it is not read.
+typedef std::function<bool(const FileKey &key, EXIFInfo &result, int &status)> StagedLookup;
+
+// Called on the single format thread for every file in arrival order, with
+// parseImage's status, a null key if the file couldn't be stat'ed, and
+// whether the lookup answered it, and the file's fingerprint (0 unless
+// options.fingerprint is set and the file decoded). CSV rows go to rows,
+// which the write thread drains into the output file.
+typedef std::function<void(const std::string &fileName, const FileKey *key, EXIFInfo &result,
+                           int status, bool lookedUp, uint64_t fingerprint,
+                           CSVWriter &rows)> StagedFormat;
+
+// Runs the ingest as five stages joined by BoundedQueues:
+//
+//     enumerate -> read -> decode -> format -> write
+//
+// The walker threads enumerate, options.readers threads stat and read,
+// options.decoders threads run EXIFInfo::parseFrom, one thread formats and
+// one appends the formatted rows to csv. A full queue stalls the stage
+// feeding it, all the way back to the directory walk, and the queue gauges
+// in the metrics report show where the work piles up. Returns the number
+// of files enumerated once every stage has drained.
+size_t runStagedIngest(const std::string &root, const WalkOptions &walkOptions,
+                       const StagedIngestOptions &options, const StagedLookup &lookup,
+                       const StagedFormat &format, CSVWriter &csv);
+
+#endif /* defined(__photo_exif_parsing__staged_ingest__) */
@@ -0,0 +1,83 @@
+//
+//  time_index.cpp
+//  photo-exif-parsing
+//
+
+#include "time_index.h"
+
+#include <algorithm>
+
+namespace {
+    // Start of the bucket holding time; rounds down for pre-1970 photos too.
+    inline int64_t bucketStart(int64_t time, int64_t width) {
+        int64_t remainder = time % width;
+        return remainder < 0 ? time - remainder - width : time - remainder;
+    }
+
+    void rollUp(const std::vector<int64_t> &times, int64_t width, std::vector<TimeBucket> &buckets) {
+        buckets.clear();
+        for (size_t i = 0; i < times.size(); i++) {
+            int64_t start = bucketStart(times[i], width);
+            if (buckets.empty() || buckets.back().start != start)
+            {
+                TimeBucket bucket = { start, 0 };
+                buckets.push_back(bucket);
+            }
+            buckets.back().count++;
+        }
+    }
+
+    bool startsBefore(const TimeBucket &bucket, int64_t time) {
+        return bucket.start < time;
+    }
+}
+
+const int64_t TimeIndex::kNanosPerHour;
+const int64_t TimeIndex::kNanosPerDay;
+
+void TimeIndex::build(const PhotoTable &photos, WorkStealingPool *pool) {
+    rows = photos.sortedByTime(pool);
+
+    const std::vector<int64_t> &taken = photos.timesTaken();
+    times.resize(rows.size());
+    for (size_t i = 0; i < rows.size(); i++) times[i] = taken[rows[i]];
+
+    rollUp(times, kNanosPerDay, dayCounts);
+    rollUp(times, kNanosPerHour, hourCounts);
+}
+
+std::pair<size_t, size_t> TimeIndex::range(int64_t begin, int64_t end) const {
+    if (begin >= end) return std::make_pair((size_t)0, (size_t)0);
+    size_t first = std::lower_bound(times.begin(), times.end(), begin) - times.begin();
+    size_t last = std::lower_bound(times.begin() + first, times.end(), end) - times.begin();
+    return std::make_pair(first, last);
+}
+
+size_t TimeIndex::countBetween(int64_t begin, int64_t end) const {
+    std::pair<size_t, size_t> span = range(begin, end);
+    return span.second - span.first;
+}
+
+void TimeIndex::rowsBetween(int64_t begin, int64_t end, std::vector<RowId> &out) const {
+    std::pair<size_t, size_t> span = range(begin, end);
+    out.insert(out.end(), rows.begin() + span.first, rows.begin() + span.second);
+}
+
+std::vector<TimeBucket> TimeIndex::slice(const std::vector<TimeBucket> &buckets, int64_t width,
+                                         int64_t begin, int64_t end) {
+    if (begin >= end) return std::vector<TimeBucket>();
+    int64_t firstStart = begin == INT64_MIN ? INT64_MIN : bucketStart(begin, width);
+    std::vector<TimeBucket>::const_iterator first =
+        std::lower_bound(buckets.begin(), buckets.end(), firstStart, startsBefore);
+    std::vector<TimeBucket>::const_iterator last =
+        std::lower_bound(first, buckets.end(), end, startsBefore);
+    return std::vector<TimeBucket>(first, last);
+}
+
+std::vector<TimeBucket> TimeIndex::days(int64_t begin, int64_t end) const {
+    return slice(dayCounts, kNanosPerDay, begin, end);
+}
+
+std::vector<TimeBucket> TimeIndex::hours(int64_t begin, int64_t end) const {
+    return slice(hourCounts, kNanosPerHour, begin, end);
+}
@@ -0,0 +1,71 @@
+//
+//  time_index.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__time_index__
+#define __photo_exif_parsing__time_index__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "photo_table.h"
+
+class WorkStealingPool;
+
+// Photos taken in one UTC day or hour.
+struct TimeBucket
+{
+    int64_t start;      // nanoseconds since the epoch
+    uint32_t count;
+};
+
+// Capture times of a PhotoTable in sorted order, next to the row each came
+// from, plus per-day and per-hour counts rolled up at build time. Range
+// queries are two binary searches over the sorted times and histograms are
+// slices of the rollups, so neither touches the table itself.
+//
+// Times are nanoseconds since the epoch, as in PhotoTable::timesTaken().
+// Build again after appending rows.
+class TimeIndex
+{
+public:
+    static const int64_t kNanosPerHour = 3600LL * 1000000000LL;
+    static const int64_t kNanosPerDay = 24 * kNanosPerHour;
+
+    // Sorts with PhotoTable::sortedByTime, so the pool must be idle.
+    void build(const PhotoTable &photos, WorkStealingPool *pool = nullptr);
+
+    size_t size() const { return times.size(); }
+
+    // Positions [first, second) in sorted order of the photos with
+    // begin <= time < end.
+    std::pair<size_t, size_t> range(int64_t begin, int64_t end) const;
+
+    size_t countBetween(int64_t begin, int64_t end) const;
+
+    // Appends the rows taken in [begin, end) to rows, oldest first.
+    void rowsBetween(int64_t begin, int64_t end, std::vector<RowId> &rows) const;
+
+    // Non-empty buckets overlapping [begin, end), oldest first. Buckets are
+    // counted whole, so the first and last may include photos outside the
+    // range when it doesn't start and end on bucket boundaries.
+    std::vector<TimeBucket> days(int64_t begin = INT64_MIN, int64_t end = INT64_MAX) const;
+    std::vector<TimeBucket> hours(int64_t begin = INT64_MIN, int64_t end = INT64_MAX) const;
+
+    // Sorted capture times and the row behind each one.
+    const std::vector<int64_t> &sortedTimes() const { return times; }
+    const std::vector<RowId> &sortedRows() const { return rows; }
+
+private:
+    static std::vector<TimeBucket> slice(const std::vector<TimeBucket> &buckets, int64_t width,
+                                         int64_t begin, int64_t end);
+
+    std::vector<int64_t> times;
+    std::vector<RowId> rows;
+    std::vector<TimeBucket> dayCounts;
+    std::vector<TimeBucket> hourCounts;
+};
+
+#endif /* defined(__photo_exif_parsing__time_index__) */
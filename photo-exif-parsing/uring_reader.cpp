@@ -0,0 +1,350 @@
+//
+//  uring_reader.cpp
+//  photo-exif-parsing
+//
+
+#include "uring_reader.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+namespace {
+    enum SlotState { SLOT_FREE, SLOT_OPENING, SLOT_READING, SLOT_CLOSING };
+
+    // Marks the completions of cancel requests, which carry the slot they
+    // target in the low bits.
+    const uint64_t kCancelTag = 1ULL << 32;
+
+    int uringSetup(unsigned entries, struct io_uring_params *params) {
+        return (int)syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+}
+
+struct BatchHeaderReader::Ring
+{
+    int fd;
+    void *sqMap;
+    size_t sqMapSize;
+    void *cqMap;
+    size_t cqMapSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+
+    unsigned pending;   // SQEs filled in but not yet handed to the kernel
+
+    Ring() : fd(-1), sqMap(MAP_FAILED), sqMapSize(0), cqMap(MAP_FAILED), cqMapSize(0),
+             sqes((struct io_uring_sqe *)MAP_FAILED), sqesSize(0), pending(0) {}
+
+    ~Ring() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+        if (cqMap != MAP_FAILED && cqMap != sqMap) munmap(cqMap, cqMapSize);
+        if (sqMap != MAP_FAILED) munmap(sqMap, sqMapSize);
+        if (fd >= 0) close(fd);
+    }
+
+    bool init(unsigned entries) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = uringSetup(entries, &params);
+        if (fd < 0) return false;
+
+        sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap && cqMapSize > sqMapSize) sqMapSize = cqMapSize;
+
+        sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQ_RING);
+        if (sqMap == MAP_FAILED) return false;
+        if (singleMap)
+        {
+            cqMap = sqMap;
+        }
+        else
+        {
+            cqMap = mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_CQ_RING);
+            if (cqMap == MAP_FAILED) return false;
+        }
+
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = (struct io_uring_sqe *)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) return false;
+
+        char *sq = (char *)sqMap;
+        sqHead = (unsigned *)(sq + params.sq_off.head);
+        sqTail = (unsigned *)(sq + params.sq_off.tail);
+        sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned *)(sq + params.sq_off.array);
+
+        char *cq = (char *)cqMap;
+        cqHead = (unsigned *)(cq + params.cq_off.head);
+        cqTail = (unsigned *)(cq + params.cq_off.tail);
+        cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    // Whether another SQE fits before the kernel consumes some.
+    bool hasRoom() const {
+        return *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) <= sqMask;
+    }
+
+    // The caller never has more operations outstanding than the ring has
+    // entries, so a free SQE is always available.
+    struct io_uring_sqe *nextSqe() {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        struct io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        pending++;
+        return sqe;
+    }
+
+    // Submits everything queued and waits for at least one completion.
+    bool submitAndWait() {
+        for (;;) {
+            int ret = uringEnter(fd, pending, 1, IORING_ENTER_GETEVENTS);
+            if (ret >= 0)
+            {
+                pending -= (unsigned)ret < pending ? (unsigned)ret : pending;
+                return true;
+            }
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return false;
+        }
+    }
+};
+
+struct BatchHeaderReader::Slot
+{
+    SlotState state;
+    size_t index;
+    int fd;
+    ReadBuffer bytes;
+
+    Slot() : state(SLOT_FREE), index(0), fd(-1) {}
+};
+
+BatchHeaderReader::BatchHeaderReader(unsigned queueDepth, size_t headerBytes)
+: ring(nullptr), queueDepth(queueDepth ? queueDepth : 1), headerBytes(headerBytes)
+{
+    Ring *candidate = new Ring();
+    if (candidate->init(this->queueDepth))
+    {
+        ring = candidate;
+    }
+    else
+    {
+        delete candidate;
+    }
+}
+
+BatchHeaderReader::~BatchHeaderReader() {
+    delete ring;
+}
+
+int BatchHeaderReader::readAll(const std::vector<std::string> &files, const Completion &onComplete) {
+    if (!ring) return -1;
+
+    std::vector<Slot> slots(queueDepth);
+    std::vector<unsigned> freeSlots;
+    for (unsigned i = queueDepth; i > 0; i--) freeSlots.push_back(i - 1);
+
+    size_t next = 0;
+    size_t done = 0;
+    while (done < files.size()) {
+        while (!freeSlots.empty() && next < files.size()) {
+            unsigned slotIndex = freeSlots.back();
+            freeSlots.pop_back();
+            Slot &slot = slots[slotIndex];
+            slot.state = SLOT_OPENING;
+            slot.index = next++;
+
+            struct io_uring_sqe *sqe = ring->nextSqe();
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (unsigned long)files[slot.index].c_str();
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            sqe->user_data = slotIndex;
+        }
+
+        if (!ring->submitAndWait())
+        {
+            abandon(slots);
+            return -1;
+        }
+
+        unsigned head = *ring->cqHead;
+        unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe &cqe = ring->cqes[head & ring->cqMask];
+            unsigned slotIndex = (unsigned)cqe.user_data;
+            Slot &slot = slots[slotIndex];
+
+            if (slot.state == SLOT_OPENING)
+            {
+                if (cqe.res < 0)
+                {
+                    ReadBuffer none;
+                    onComplete(slot.index, none, false, -1);
+                    slot.state = SLOT_FREE;
+                    freeSlots.push_back(slotIndex);
+                    done++;
+                    continue;
+                }
+                slot.fd = cqe.res;
+                slot.bytes.resize(headerBytes);
+                slot.state = SLOT_READING;
+
+                struct io_uring_sqe *sqe = ring->nextSqe();
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = slot.fd;
+                sqe->addr = (unsigned long)slot.bytes.data();
+                sqe->len = (unsigned)headerBytes;
+                sqe->off = 0;
+                sqe->user_data = slotIndex;
+            }
+            else if (slot.state == SLOT_READING)
+            {
+                if (cqe.res < 0)
+                {
+                    slot.bytes.clear();
+                    onComplete(slot.index, slot.bytes, false, -2);
+                }
+                else
+                {
+                    slot.bytes.resize((size_t)cqe.res);
+                    bool reachedEnd = (size_t)cqe.res < headerBytes;
+                    onComplete(slot.index, slot.bytes, reachedEnd, 0);
+                }
+                done++;
+                slot.state = SLOT_CLOSING;
+
+                struct io_uring_sqe *sqe = ring->nextSqe();
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = slot.fd;
+                sqe->user_data = slotIndex;
+            }
+            else if (slot.state == SLOT_CLOSING)
+            {
+                slot.fd = -1;
+                slot.state = SLOT_FREE;
+                freeSlots.push_back(slotIndex);
+            }
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    // Drain the closes still in flight so every descriptor is released
+    // before the slots go away.
+    for (;;) {
+        bool closing = false;
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].state == SLOT_CLOSING) closing = true;
+        }
+        if (!closing) break;
+        if (!ring->submitAndWait())
+        {
+            abandon(slots);
+            return -1;
+        }
+
+        unsigned head = *ring->cqHead;
+        unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe &cqe = ring->cqes[head & ring->cqMask];
+            slots[(unsigned)cqe.user_data].state = SLOT_FREE;
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+void BatchHeaderReader::abandon(std::vector<Slot> &slots) {
+    // Opens and reads are cancelled; closes finish quickly on their own.
+    unsigned inFlight = 0;
+    for (size_t i = 0; i < slots.size(); i++) {
+        const Slot &slot = slots[i];
+        if (slot.state == SLOT_FREE) continue;
+        inFlight++;
+        if (slot.state == SLOT_CLOSING || !ring->hasRoom()) continue;
+        struct io_uring_sqe *sqe = ring->nextSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = i;
+        sqe->user_data = kCancelTag | i;
+    }
+
+    // Every operation still ends in a completion of its own, cancelled or
+    // not; only then is its slot safe to free.
+    while (inFlight > 0 && ring->submitAndWait()) {
+        unsigned head = *ring->cqHead;
+        unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe &cqe = ring->cqes[head & ring->cqMask];
+            if (cqe.user_data & kCancelTag) continue;
+            Slot &slot = slots[(unsigned)cqe.user_data];
+            if (slot.state == SLOT_OPENING && cqe.res >= 0) close(cqe.res);
+            else if (slot.state == SLOT_READING) close(slot.fd);
+            slot.fd = -1;
+            slot.state = SLOT_FREE;
+            inFlight--;
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+    if (inFlight == 0) return;
+
+    // The ring can't even be waited on. Buffers the kernel may still write
+    // to are leaked rather than freed, descriptors whose read is pending
+    // are closed (the read holds its own reference), and the ring is given
+    // up so later batches take the blocking path.
+    for (size_t i = 0; i < slots.size(); i++) {
+        Slot &slot = slots[i];
+        if (slot.state == SLOT_FREE) continue;
+        if (slot.state == SLOT_READING) close(slot.fd);
+        new ReadBuffer(std::move(slot.bytes));
+        slot.state = SLOT_FREE;
+    }
+    delete ring;
+    ring = nullptr;
+}
+
+#else
+
+struct BatchHeaderReader::Ring {};
+
+BatchHeaderReader::BatchHeaderReader(unsigned queueDepth, size_t headerBytes)
+: ring(nullptr), queueDepth(queueDepth), headerBytes(headerBytes)
+{
+}
+
+BatchHeaderReader::~BatchHeaderReader() {
+}
+
+int BatchHeaderReader::readAll(const std::vector<std::string> &, const Completion &) {
+    return -1;
+}
+
+#endif
@@ -0,0 +1,60 @@
+//
+//  uring_reader.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__uring_reader__
+#define __photo_exif_parsing__uring_reader__
+
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "image_reader.h"
+
+// Reads the leading bytes of many files through a Linux io_uring, keeping
+// up to queueDepth open/read/close chains in flight at once and handing each
+// header over as soon as its read completes, in whatever order that is.
+//
+// The ring is driven with raw syscalls so there is no liburing dependency.
+// On other platforms, or when the kernel refuses to set up a ring,
+// available() is false and callers should fall back to parseImage.
+class BatchHeaderReader
+{
+public:
+    // Runs on the thread calling readAll. bytes may be swapped out and kept;
+    // reachedEnd is true when bytes hold the whole file. status is 0, -1 if
+    // the file could not be opened or -2 if it could not be read.
+    typedef std::function<void(size_t index, ReadBuffer &bytes,
+                               bool reachedEnd, int status)> Completion;
+
+    explicit BatchHeaderReader(unsigned queueDepth = 256,
+                               size_t headerBytes = kInitialHeaderRead);
+    ~BatchHeaderReader();
+
+    bool available() const { return ring != nullptr; }
+
+    // Reads the header range of every entry of files and reports each one
+    // through onComplete. Returns 0, or -1 if the ring failed mid-batch;
+    // files not reported by then were not read and every descriptor the
+    // batch opened is closed. A ring that can't be recovered is dropped
+    // and available() turns false.
+    int readAll(const std::vector<std::string> &files, const Completion &onComplete);
+
+private:
+    struct Ring;
+    struct Slot;
+
+    // Cancels and waits out whatever a failed batch left in flight.
+    void abandon(std::vector<Slot> &slots);
+
+    Ring *ring;
+    unsigned queueDepth;
+    size_t headerBytes;
+
+    BatchHeaderReader(const BatchHeaderReader &);
+    BatchHeaderReader &operator=(const BatchHeaderReader &);
+};
+
+#endif /* defined(__photo_exif_parsing__uring_reader__) */
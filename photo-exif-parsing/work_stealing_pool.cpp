@@ -0,0 +1,127 @@
+//
+//  work_stealing_pool.cpp
+//  photo-exif-parsing
+//
+
+#include "work_stealing_pool.h"
+
+namespace {
+    // Pool the current thread belongs to and its slot in it.
+    thread_local const WorkStealingPool *currentPool = nullptr;
+    thread_local int currentIndex = -1;
+}
+
+WorkStealingPool::WorkStealingPool(unsigned threadCount)
+: queued(0), unfinished(0), nextWorker(0), stopping(false)
+{
+    if (threadCount == 0) threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0) threadCount = 1;
+
+    for (unsigned i = 0; i < threadCount; i++) {
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for (unsigned i = 0; i < threadCount; i++) {
+        threads.push_back(std::thread(&WorkStealingPool::run, this, i));
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(idleLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+int WorkStealingPool::currentWorker() {
+    return currentIndex;
+}
+
+void WorkStealingPool::submit(Task task) {
+    unsigned index;
+    if (currentPool == this && currentIndex >= 0)
+    {
+        index = (unsigned)currentIndex;
+    }
+    else
+    {
+        index = nextWorker.fetch_add(1, std::memory_order_relaxed) % size();
+    }
+
+    unfinished.fetch_add(1);
+    {
+        // Taking idleLock orders the increment against a worker that has
+        // just checked queued and is about to sleep. A worker that wakes
+        // before the push below lands simply retries.
+        std::lock_guard<std::mutex> guard(idleLock);
+        queued.fetch_add(1);
+    }
+    {
+        std::lock_guard<std::mutex> guard(workers[index]->lock);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> guard(idleLock);
+    drained.wait(guard, [this] { return unfinished.load() == 0; });
+}
+
+bool WorkStealingPool::popLocal(unsigned index, Task &task) {
+    Worker &worker = *workers[index];
+    std::lock_guard<std::mutex> guard(worker.lock);
+    if (worker.tasks.empty()) return false;
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::steal(unsigned thief, Task &task) {
+    unsigned count = size();
+    for (unsigned i = 1; i < count; i++) {
+        Worker &victim = *workers[(thief + i) % count];
+        std::unique_lock<std::mutex> guard(victim.lock, std::try_to_lock);
+        if (!guard.owns_lock() || victim.tasks.empty()) continue;
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::run(unsigned index) {
+    currentPool = this;
+    currentIndex = (int)index;
+
+    for (;;) {
+        Task task;
+        if (popLocal(index, task) || steal(index, task))
+        {
+            queued.fetch_sub(1);
+            task();
+            if (unfinished.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> guard(idleLock);
+                drained.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(idleLock);
+        if (stopping) return;
+        if (queued.load() > 0)
+        {
+            // Work exists but a try_lock lost the race; go around again.
+            guard.unlock();
+            std::this_thread::yield();
+            continue;
+        }
+        wake.wait(guard, [this] { return stopping || queued.load() > 0; });
+        if (stopping && queued.load() == 0) return;
+    }
+}
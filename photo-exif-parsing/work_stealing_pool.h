@@ -0,0 +1,70 @@
+//
+//  work_stealing_pool.h
+//  photo-exif-parsing
+//
+
+#ifndef __photo_exif_parsing__work_stealing_pool__
+#define __photo_exif_parsing__work_stealing_pool__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size thread pool where every worker owns a deque of tasks. A worker
+// pops from the back of its own deque and, once that runs dry, steals from
+// the front of its siblings' deques, so a slow file on one worker never
+// leaves the others idle.
+class WorkStealingPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    // threadCount == 0 picks std::thread::hardware_concurrency().
+    explicit WorkStealingPool(unsigned threadCount = 0);
+    ~WorkStealingPool();
+
+    // Queues a task. Calls from a worker go onto that worker's own deque,
+    // calls from any other thread are spread round-robin.
+    void submit(Task task);
+
+    // Blocks until every submitted task has finished running.
+    void wait();
+
+    unsigned size() const { return (unsigned)workers.size(); }
+
+    // Index of the calling worker, or -1 when called from outside the pool.
+    static int currentWorker();
+
+private:
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    bool popLocal(unsigned index, Task &task);
+    bool steal(unsigned thief, Task &task);
+    void run(unsigned index);
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::vector<std::thread> threads;
+
+    std::mutex idleLock;
+    std::condition_variable wake;
+    std::condition_variable drained;
+
+    std::atomic<size_t> queued;
+    std::atomic<size_t> unfinished;
+    std::atomic<unsigned> nextWorker;
+    bool stopping;
+
+    WorkStealingPool(const WorkStealingPool &);
+    WorkStealingPool &operator=(const WorkStealingPool &);
+};
+
+#endif /* defined(__photo_exif_parsing__work_stealing_pool__) */